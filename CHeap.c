@@ -4,7 +4,13 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include "CHeap.h"
+#ifdef CHEAP_THREAD_SAFE
+#include <pthread.h>
+#endif
  
 /*
  * This structure serves as the header for each allocated and free block.
@@ -12,10 +18,10 @@
  */
 typedef struct blockHeader {           
 
-    int size_status;
+    bsize_t size_status;
 
     /*
-     * Size of the block is always a multiple of 8.
+     * Size of the block is always a multiple of ALIGNMENT.
      * Size is stored in all block headers and in free block footers.
      *
      * Status is stored only in headers using the two least significant bits.
@@ -46,290 +52,2808 @@ typedef struct blockHeader {
      */
 } blockHeader;         
 
+/*
+ * Every payload starts at a multiple of ALIGNMENT. The default 4 byte
+ * header gives 8 byte alignment, CHEAP_WIDE_HEADER an 8 byte header and
+ * 16 byte alignment.
+ */
+#ifdef CHEAP_WIDE_HEADER
+#define ALIGNMENT 16
+#define BSIZE_MAX LONG_MAX
+#else
+#define ALIGNMENT 8
+#define BSIZE_MAX INT_MAX
+#endif
+
 /* Global variable - DO NOT CHANGE. It should always point to the first block,
  * i.e., the block at the lowest address.
  */
-blockHeader *heap_start = NULL;     
+blockHeader *heap_start = NULL;     
+
+/* Size of heap allocation padded to round to nearest page size.
+ */
+bsize_t alloc_size;
+
+/*
+ * Additional global variables may be added as needed below
+ */
+
+/*
+ * Every free block keeps links to its neighbours in its size class list.
+ * They are stored in the payload, right after the header, so together with
+ * the header and footer a block must be at least MIN_BLOCK_SIZE bytes.
+ */
+typedef struct freeLinks {
+    blockHeader *next;
+    blockHeader *prev;
+} freeLinks;
+
+/*
+ * Free blocks are kept in segregated lists by size class.
+ * Classes 0 to 13 each hold a single size (24, 32, ..., 128 bytes),
+ * every class above that covers a power-of-two range of sizes.
+ * With CHEAP_WIDE_HEADER classes 0 to 6 hold 32, 48, ..., 128 bytes and the
+ * range classes go on up to 2^63.
+ */
+#ifdef CHEAP_WIDE_HEADER
+#define MIN_BLOCK_SIZE 32
+#define NUM_SIZE_CLASSES 63
+#else
+#define MIN_BLOCK_SIZE 24
+#define NUM_SIZE_CLASSES 38
+#endif
+#define EXACT_CLASS_MAX 128
+#define EXACT_CLASSES ((EXACT_CLASS_MAX - MIN_BLOCK_SIZE) / ALIGNMENT + 1)
+
+/*
+ * Default coalescing mode used by bfree.
+ * 0 => deferred, adjacent free blocks are only merged by coalesce()
+ * 1 => immediate, bfree merges the freed block with both free neighbours
+ * Build with -DCHEAP_IMMEDIATE_COALESCE=1 to change the default or call
+ * set_coalesce_mode() at runtime.
+ */
+#ifndef CHEAP_IMMEDIATE_COALESCE
+#define CHEAP_IMMEDIATE_COALESCE 0
+#endif
+
+/*
+ * Default placement policy of balloc, one of the CHEAP_FIT_ policies in
+ * CHeap.h. Build with -DCHEAP_FIT_POLICY=... to change it or call
+ * set_fit_policy() at runtime.
+ * Good-fit looks at no more than GOOD_FIT_DEPTH blocks of a size class.
+ */
+#ifndef CHEAP_FIT_POLICY
+#define CHEAP_FIT_POLICY CHEAP_FIT_BEST
+#endif
+#define GOOD_FIT_DEPTH 8
+
+/*
+ * Slabs serve small fixed size objects (16, 32, 64 and 128 bytes) without
+ * a header per object, see salloc below.
+ */
+#define SLAB_CLASSES 4
+#define SLAB_MIN_OBJ 16
+#define SLAB_MAX_OBJ 128
+
+/*
+ * Size of the huge pages used by CHEAP_MAP_HUGETLB and CHEAP_MAP_THP, the
+ * default huge page size on x86-64 and most arm64 kernels.
+ */
+#ifndef HUGE_PAGE_SIZE
+#define HUGE_PAGE_SIZE (2 << 20)
+#endif
+
+#define MAP_FILE_BACKED 0x100 //map_flags of an arena made by arena_open_file
+
+/*
+ * Debug mode, build with -DCHEAP_DEBUG. It is meant to stay on in canary
+ * deployments, so every check is either constant time or sampled:
+ * - an allocated block keeps a canary word in the slot a free block uses
+ *   for its footer. The canary mixes the block's address and size, so an
+ *   overrun of the payload and a damaged header both show up when the
+ *   block is freed or resized.
+ * - the first POISON_BYTES bytes of a freed payload are filled with
+ *   POISON_BYTE, so reads through a stale pointer see obvious garbage.
+ * - every check_interval heap operations the whole block list is checked
+ *   like check_heap does, and after every coalesce.
+ * Corruption found by any of these is reported and the program aborted.
+ */
+#ifdef CHEAP_DEBUG
+#define CANARY_SIZE sizeof(blockHeader)
+#define CANARY_KEY 0x5ca1ab1eUL
+#define POISON_BYTE 0xdf
+#define POISON_BYTES 256
+#ifndef CHEAP_CHECK_INTERVAL
+#define CHEAP_CHECK_INTERVAL 8192
+#endif
+#else
+#define CANARY_SIZE 0
+#endif
+
+/*
+ * An arena is an independent heap with its own mapped region, end mark and
+ * free lists. balloc, bfree, coalesce and disp_heap work on main_arena,
+ * which init_heap sets up. Arenas made by arena_create keep this structure
+ * at the start of their own region, so arena_destroy releases the arena
+ * and every block in it with a single munmap.
+ */
+struct arena {
+    blockHeader *heap_start; //first block of the arena
+    blockHeader *end_mark;   //end mark right after the last block
+    bsize_t alloc_size;      //bytes from heap_start up to the end mark
+    void *mmap_ptr;          //start of the mapped region
+    bsize_t map_size;        //size of the mapped region
+    int immediate_coalesce;  //coalescing mode used by bfree
+    int fit_policy;          //CHEAP_FIT_ policy used to pick free blocks
+    int map_flags;           //CHEAP_MAP_ flags the region is mapped with
+    bsize_t max_size;        //0 => fixed size, else address space reserved for the region to grow into
+    unsigned long long free_list_map; //bit i is set when free_lists[i] is not empty
+    blockHeader *free_lists[NUM_SIZE_CLASSES];
+    blockHeader *rovers[NUM_SIZE_CLASSES]; //next-fit starts here, NULL => at the head of the list
+    struct slab *slab_partial[SLAB_CLASSES]; //slabs with free objects, by object size
+    struct slab *slab_full[SLAB_CLASSES];    //slabs without free objects
+    blockHeader *region;     //region block at the top of the heap, NULL outside region mode
+    char *region_ptr;        //next free byte of the region
+    heapStats stats;         //counters, the rest is filled in by arena_heap_stats
+#ifdef CHEAP_DEBUG
+    int check_interval;      //heap operations between full checks, 0 => no sampled checks
+    int check_countdown;     //operations left until the next full check
+#endif
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_t lock;
+#endif
+};
+
+/* The arena behind heap_start and alloc_size.
+ */
+arena_t main_arena = {
+    .immediate_coalesce = CHEAP_IMMEDIATE_COALESCE,
+    .fit_policy = CHEAP_FIT_POLICY,
+#ifdef CHEAP_DEBUG
+    .check_interval = CHEAP_CHECK_INTERVAL,
+    .check_countdown = CHEAP_CHECK_INTERVAL,
+#endif
+#ifdef CHEAP_THREAD_SAFE
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+#endif
+};
+
+/*
+ * The p-bit of an allocated block is updated by whoever allocates or frees
+ * the block right before it, while in thread-safe mode bfree reads its own
+ * header without holding the heap lock. Those accesses go through these
+ * macros so they are atomic when CHEAP_THREAD_SAFE is defined.
+ */
+#ifdef CHEAP_THREAD_SAFE
+#define LOAD_STATUS(block) __atomic_load_n(&(block)->size_status, __ATOMIC_RELAXED)
+#define SET_PBIT(block) __atomic_fetch_or(&(block)->size_status, 2, __ATOMIC_RELAXED)
+#define CLEAR_PBIT(block) __atomic_fetch_and(&(block)->size_status, ~2, __ATOMIC_RELAXED)
+#else
+#define LOAD_STATUS(block) ((block)->size_status)
+#define SET_PBIT(block) ((block)->size_status |= 2)
+#define CLEAR_PBIT(block) ((block)->size_status &= ~2)
+#endif
+
+/*
+ * Returns the size of a block without the a and p bit.
+ */
+static bsize_t block_size(blockHeader *block) {
+    return (block->size_status >> 2) << 2;
+}
+
+/*
+ * Returns the links stored in the payload of a free block.
+ */
+static freeLinks* free_links(blockHeader *block) {
+    return (freeLinks*)((char*)block + sizeof(blockHeader));
+}
+
+/*
+ * Writes the footer of a free block, it only contains the size.
+ */
+static void write_footer(blockHeader *block) {
+    bsize_t size = block_size(block);
+    ((blockHeader*)((char*)block + size - sizeof(blockHeader)))->size_status = size;
+}
+
+#ifdef CHEAP_DEBUG
+static const char* check_blocks(arena_t *arena, int allowAdjacentFree, blockHeader **where, int *counter);
+
+/*
+ * Returns the canary an allocated block must end with.
+ */
+static bsize_t canary_value(blockHeader *block) {
+    return (bsize_t)(CANARY_KEY ^ (unsigned long)block ^ (unsigned long)block_size(block));
+}
+
+static blockHeader* canary_slot(blockHeader *block) {
+    return (blockHeader*)((char*)block + block_size(block) - sizeof(blockHeader));
+}
+
+/*
+ * Reports heap corruption found at 'block' and aborts, going on would
+ * only spread the damage.
+ */
+static void heap_corrupted(blockHeader *block, const char *problem) {
+    fprintf(stderr, "Error:mem.c: heap corrupted at block 0x%08lx: %s\n", (unsigned long int)block, problem);
+    abort();
+}
+
+static void write_canary(blockHeader *block) {
+    canary_slot(block)->size_status = canary_value(block);
+}
+
+static void check_canary(blockHeader *block) {
+    if(canary_slot(block)->size_status != canary_value(block)) {
+        heap_corrupted(block, "canary overwritten");
+    }
+}
+
+/*
+ * Fills the start of the payload of a block that is being freed with
+ * POISON_BYTE, the canary is left alone.
+ */
+static void poison_payload(blockHeader *block) {
+    bsize_t length = block_size(block) - sizeof(blockHeader) - CANARY_SIZE;
+    memset((char*)block + sizeof(blockHeader), POISON_BYTE, length < POISON_BYTES ? length : POISON_BYTES);
+}
+
+/*
+ * Checks the whole block list of 'arena' and aborts if it is damaged.
+ * The caller must hold the arena lock in thread-safe mode.
+ */
+static void verify_heap(arena_t *arena, int allowAdjacentFree) {
+    blockHeader *where;
+    int counter;
+    const char *problem = check_blocks(arena, allowAdjacentFree, &where, &counter);
+
+    if(problem != NULL) {
+        heap_corrupted(where, problem);
+    }
+}
+
+/*
+ * Counts a heap operation on 'arena' and runs the full check on every
+ * check_interval-th one.
+ */
+static void sample_check(arena_t *arena) {
+    if(arena->check_interval > 0 && --arena->check_countdown <= 0) {
+        arena->check_countdown = arena->check_interval;
+        verify_heap(arena, !arena->immediate_coalesce);
+    }
+}
+#else
+#define write_canary(block)
+#define check_canary(block)
+#define poison_payload(block)
+#define sample_check(arena)
+#endif
+
+/*
+ * Returns floor(log2(size)) of a positive size.
+ */
+static int floor_log2(bsize_t size) {
+    return 63 - __builtin_clzll((unsigned long long)size);
+}
+
+/*
+ * Returns the size class that a block of 'size' bytes belongs to.
+ */
+static int size_class(bsize_t size) {
+    if(size <= EXACT_CLASS_MAX) {
+        return (size - MIN_BLOCK_SIZE) / ALIGNMENT;
+    }
+    //floor(log2(size - 1)) is at least 7 here, so (128, 256] maps to the first range class
+    int sizeClass = EXACT_CLASSES + floor_log2(size - 1) - 7;
+    return sizeClass < NUM_SIZE_CLASSES ? sizeClass : NUM_SIZE_CLASSES - 1;
+}
+
+/*
+ * Pushes a free block onto the front of its size class list. With first-fit
+ * the lists are kept sorted by address instead.
+ */
+static void insert_free_block(arena_t *arena, blockHeader *block) {
+    int sizeClass = size_class(block_size(block));
+    freeLinks *links = free_links(block);
+    blockHeader *prev = NULL;
+    blockHeader *next = arena->free_lists[sizeClass];
+
+    if(arena->fit_policy == CHEAP_FIT_FIRST) {
+        while(next != NULL && next < block) {
+            prev = next;
+            next = free_links(next)->next;
+        }
+    }
+    links->prev = prev;
+    links->next = next;
+    if(next != NULL) {
+        free_links(next)->prev = block;
+    }
+    if(prev != NULL) {
+        free_links(prev)->next = block;
+    } else {
+        arena->free_lists[sizeClass] = block;
+    }
+    arena->free_list_map |= 1ULL << sizeClass;
+    arena->stats.free_blocks++;
+    arena->stats.free_bytes += block_size(block);
+}
+
+/*
+ * Unlinks a free block from its size class list.
+ */
+static void remove_free_block(arena_t *arena, blockHeader *block) {
+    int sizeClass = size_class(block_size(block));
+    freeLinks *links = free_links(block);
+
+    if(arena->rovers[sizeClass] == block) { //next-fit carries on after the block
+        arena->rovers[sizeClass] = links->next;
+    }
+    if(links->prev != NULL) {
+        free_links(links->prev)->next = links->next;
+    } else {
+        arena->free_lists[sizeClass] = links->next;
+        if(links->next == NULL) { //list is now empty
+            arena->free_list_map &= ~(1ULL << sizeClass);
+        }
+    }
+    if(links->next != NULL) {
+        free_links(links->next)->prev = links->prev;
+    }
+    arena->stats.free_blocks--;
+    arena->stats.free_bytes -= block_size(block);
+}
+
+/*
+ * Puts every free block of 'arena' back on the free lists, e.g. after its
+ * heap was mapped back in from a file. Blocks are appended in address
+ * order, so the lists come out sorted as first-fit needs them.
+ */
+static void rebuild_free_lists(arena_t *arena) {
+    blockHeader *tails[NUM_SIZE_CLASSES] = {NULL};
+    blockHeader *current = arena->heap_start;
+    freeLinks *links;
+    int sizeClass;
+
+    memset(arena->free_lists, 0, sizeof(arena->free_lists));
+    memset(arena->rovers, 0, sizeof(arena->rovers));
+    arena->free_list_map = 0;
+    arena->stats.free_blocks = 0;
+    arena->stats.free_bytes = 0;
+    while(current->size_status != 1) {
+        if(!(current->size_status & 1)) {
+            sizeClass = size_class(block_size(current));
+            links = free_links(current);
+            links->next = NULL;
+            links->prev = tails[sizeClass];
+            if(tails[sizeClass] != NULL) {
+                free_links(tails[sizeClass])->next = current;
+            } else {
+                arena->free_lists[sizeClass] = current;
+                arena->free_list_map |= 1ULL << sizeClass;
+            }
+            tails[sizeClass] = current;
+            arena->stats.free_blocks++;
+            arena->stats.free_bytes += block_size(current);
+        }
+        current = (blockHeader*)((char*)current + block_size(current));
+    }
+}
+
+/*
+ * Best-fit: the smallest block of 'sizeClass' with at least 'blockSizeNeed'
+ * bytes, a perfect fit ends the search early.
+ */
+static blockHeader* best_fit(arena_t *arena, int sizeClass, bsize_t blockSizeNeed) {
+    blockHeader *currBlock = arena->free_lists[sizeClass];
+    blockHeader *currBestFit = NULL;
+    bsize_t currBestFitSize = BSIZE_MAX;
+    bsize_t currShifted;
+
+    while(currBlock != NULL) {
+        currShifted = block_size(currBlock);
+        if(currShifted == blockSizeNeed) { //perfect fit
+            return currBlock;
+        }
+        if(currShifted > blockSizeNeed && currShifted < currBestFitSize) {
+            currBestFit = currBlock;
+            currBestFitSize = currShifted;
+        }
+        currBlock = free_links(currBlock)->next;
+    }
+    return currBestFit;
+}
+
+/*
+ * Good-fit: best-fit over at most GOOD_FIT_DEPTH blocks of 'sizeClass'. A
+ * block that leaves too little to split off is as good as a perfect fit.
+ */
+static blockHeader* good_fit(arena_t *arena, int sizeClass, bsize_t blockSizeNeed) {
+    blockHeader *currBlock = arena->free_lists[sizeClass];
+    blockHeader *currBestFit = NULL;
+    bsize_t currBestFitSize = BSIZE_MAX;
+    bsize_t currShifted;
+
+    for(int depth = 0; depth < GOOD_FIT_DEPTH && currBlock != NULL; depth++) {
+        currShifted = block_size(currBlock);
+        if(currShifted >= blockSizeNeed && currShifted - blockSizeNeed < MIN_BLOCK_SIZE) {
+            return currBlock;
+        }
+        if(currShifted > blockSizeNeed && currShifted < currBestFitSize) {
+            currBestFit = currBlock;
+            currBestFitSize = currShifted;
+        }
+        currBlock = free_links(currBlock)->next;
+    }
+    return currBestFit;
+}
+
+/*
+ * Next-fit: the first block of 'sizeClass' that fits, searching from the
+ * rover of the class (where the last search stopped) and wrapping around
+ * to the head of the list.
+ */
+static blockHeader* next_fit(arena_t *arena, int sizeClass, bsize_t blockSizeNeed) {
+    blockHeader *start = arena->rovers[sizeClass] != NULL ? arena->rovers[sizeClass] : arena->free_lists[sizeClass];
+    blockHeader *currBlock = start;
+
+    while(currBlock != NULL) {
+        if(block_size(currBlock) >= blockSizeNeed) {
+            arena->rovers[sizeClass] = currBlock; //moves on when the block is taken off the list
+            return currBlock;
+        }
+        currBlock = free_links(currBlock)->next;
+        if(currBlock == NULL) {
+            currBlock = arena->free_lists[sizeClass];
+        }
+        if(currBlock == start) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * First-fit: the lowest addressed block with at least 'blockSizeNeed' bytes.
+ * Lists are sorted by address, so this is the first fit in 'sizeClass' or
+ * the lowest head of the larger classes, every block there fits.
+ */
+static blockHeader* first_fit(arena_t *arena, int sizeClass, bsize_t blockSizeNeed) {
+    blockHeader *currBlock = arena->free_lists[sizeClass];
+    unsigned long long larger = arena->free_list_map & ~((2ULL << sizeClass) - 1);
+
+    while(currBlock != NULL && block_size(currBlock) < blockSizeNeed) {
+        currBlock = free_links(currBlock)->next;
+    }
+    for(; larger != 0; larger &= larger - 1) {
+        blockHeader *head = arena->free_lists[__builtin_ctzll(larger)];
+        if(currBlock == NULL || head < currBlock) {
+            currBlock = head;
+        }
+    }
+    return currBlock;
+}
+
+/*
+ * Finds a free block of at least 'blockSizeNeed' bytes with the placement
+ * policy of 'arena'.
+ * The class the request maps to is searched first, if nothing there is big
+ * enough the head of the next non-empty class is used since every block in
+ * a larger class fits.
+ * Returns NULL if there is no such block.
+ */
+static blockHeader* find_fit(arena_t *arena, bsize_t blockSizeNeed) {
+    int sizeClass = size_class(blockSizeNeed);
+    blockHeader *fit;
+
+    switch(arena->fit_policy) {
+        case CHEAP_FIT_FIRST:
+            return first_fit(arena, sizeClass, blockSizeNeed);
+        case CHEAP_FIT_NEXT:
+            fit = next_fit(arena, sizeClass, blockSizeNeed);
+            break;
+        case CHEAP_FIT_GOOD:
+            fit = good_fit(arena, sizeClass, blockSizeNeed);
+            break;
+        default:
+            fit = best_fit(arena, sizeClass, blockSizeNeed);
+            break;
+    }
+    if(fit != NULL) {
+        return fit;
+    }
+
+    unsigned long long larger = arena->free_list_map & ~((2ULL << sizeClass) - 1); //non-empty classes above sizeClass
+    if(larger == 0) {
+        return NULL;
+    }
+    return arena->free_lists[__builtin_ctzll(larger)];
+}
+
+/*
+ * Marks the free block 'block' as allocated using 'blockSizeNeed' bytes of it.
+ * The block must already be removed from its free list.
+ * If the rest is big enough to be a block on its own it is split off
+ * and put back on a free list.
+ */
+static void place_block(arena_t *arena, blockHeader *block, bsize_t blockSizeNeed) {
+    bsize_t blockSize = block_size(block);
+    bsize_t pBit = block->size_status & 2;
+    blockHeader *nextBlock;
+
+    if(blockSize - blockSizeNeed >= MIN_BLOCK_SIZE) { //split the block, previous block of the rest is allocated
+        block->size_status = blockSizeNeed | pBit | 1;
+        nextBlock = (blockHeader*)((char*)block + blockSizeNeed);
+        nextBlock->size_status = (blockSize - blockSizeNeed) | 2;
+        write_footer(nextBlock);
+        insert_free_block(arena, nextBlock);
+    } else { //use the whole block and set the p bit of the next block
+        block->size_status = blockSize | pBit | 1;
+        nextBlock = (blockHeader*)((char*)block + blockSize);
+        if(nextBlock->size_status != 1) {
+            SET_PBIT(nextBlock);
+        }
+    }
+    write_canary(block);
+}
+
+/*
+ * Like place_block, but uses the last 'blockSizeNeed' bytes of the free
+ * block 'block' and puts the front back on a free list. The block must be
+ * at least MIN_BLOCK_SIZE bytes bigger than blockSizeNeed.
+ * Returns the header of the allocated block.
+ */
+static blockHeader* place_block_high(arena_t *arena, blockHeader *block, bsize_t blockSizeNeed) {
+    bsize_t blockSize = block_size(block);
+    blockHeader *allocBlock = (blockHeader*)((char*)block + blockSize - blockSizeNeed);
+    blockHeader *nextBlock = (blockHeader*)((char*)block + blockSize);
+
+    block->size_status = (blockSize - blockSizeNeed) | (block->size_status & 2);
+    write_footer(block);
+    insert_free_block(arena, block);
+    allocBlock->size_status = blockSizeNeed | 1; //previous block is free
+    if(nextBlock->size_status != 1) {
+        SET_PBIT(nextBlock);
+    }
+    write_canary(allocBlock);
+    return allocBlock;
+}
+
+/*
+ * Merges the free block 'block', which is not on a free list yet, with its
+ * next and previous block if they are free. The previous block is found
+ * through the p-bit and its footer, which sits right before our header.
+ * Returns the header of the merged block.
+ */
+static blockHeader* merge_neighbours(arena_t *arena, blockHeader *block) {
+    blockHeader *nextBlock = (blockHeader*)((char*)block + block_size(block));
+
+    if(nextBlock->size_status != 1 && !(nextBlock->size_status & 1)) { //next block is free
+        remove_free_block(arena, nextBlock);
+        block->size_status += block_size(nextBlock);
+        arena->stats.coalesced++;
+    }
+
+    if(!(block->size_status & 2)) { //previous block is free
+        bsize_t prevSize = ((blockHeader*)((char*)block - sizeof(blockHeader)))->size_status;
+        blockHeader *prevBlock = (blockHeader*)((char*)block - prevSize);
+        remove_free_block(arena, prevBlock);
+        prevBlock->size_status += block_size(block);
+        block = prevBlock;
+        arena->stats.coalesced++;
+    }
+
+    return block;
+}
+
+/*
+ * Frees the allocated block 'block' of 'arena' and puts it on a free list.
+ * Updates the p-bit of the next block and writes the footer.
+ */
+static void free_block(arena_t *arena, blockHeader *block) {
+    bsize_t blockSize = block_size(block);
+    check_canary(block);
+    poison_payload(block);
+    block->size_status -= 1; //set the a bit to 0
+    arena->stats.frees++;
+
+    blockHeader *nextBlock = (blockHeader*)((char*)block + blockSize); //get the next block
+    
+    if(nextBlock->size_status != 1 && nextBlock->size_status & 2) { //check if the next block is the end and if the p bit is set
+        CLEAR_PBIT(nextBlock); //set the p bit of the next block to 0
+    }   
+
+    if(arena->immediate_coalesce) { //merge with free neighbours now instead of in coalesce()
+        block = merge_neighbours(arena, block);
+    }
+    write_footer(block);
+    insert_free_block(arena, block);
+}
+
+/*
+ * Returns the page size a region mapped with the CHEAP_MAP_ 'flags' is
+ * managed in. Huge page backed regions are mapped, grown and trimmed in
+ * whole huge pages.
+ */
+static bsize_t region_page_size(int flags) {
+    if (flags & (CHEAP_MAP_HUGETLB | CHEAP_MAP_THP)) {
+        return HUGE_PAGE_SIZE;
+    }
+    return getpagesize();
+}
+
+/*
+ * Returns 'size' rounded up to a multiple of 'pagesize'.
+ */
+static bsize_t round_to(bsize_t size, bsize_t pagesize) {
+    return ((size + pagesize - 1) / pagesize) * pagesize;
+}
+
+/*
+ * Gives the pages at 'addr' back to the OS but keeps their address range
+ * reserved, like reserve_region, so the heap can map them again later.
+ */
+static void unmap_pages(void *addr, bsize_t size) {
+    mmap(addr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+}
+
+/*
+ * Maps a zero filled region of at least '*size' bytes from /dev/zero, or
+ * anonymous memory if 'flags' asks for it.
+ * '*size' is rounded up to a multiple of the page size.
+ * If 'addr' is not NULL the region replaces the pages at addr, which must
+ * be part of a range reserved by reserve_region. This is how a heap grows
+ * without moving.
+ * Argument flags: CHEAP_MAP_ flags, see CHeap.h
+ * Returns the start of the region on success.
+ * Returns NULL on failure.
+ */
+static void* map_region(void *addr, bsize_t *size, int flags) {
+    bsize_t pagesize; // page size
+    bsize_t padsize;  // size of padding when heap size not a multiple of page size
+    void* mmap_ptr;   // pointer to memory mapped area
+    int mapFlags = MAP_PRIVATE | (addr ? MAP_FIXED : 0);
+    int fd = -1;
+
+    // Get the pagesize
+    pagesize = region_page_size(flags);
+
+    // Calculate padsize as the padding required to round up size 
+    // to a multiple of pagesize
+    padsize = *size % pagesize;
+    padsize = (pagesize - padsize) % pagesize;
+
+    *size += padsize;
+
+    if (flags & CHEAP_MAP_POPULATE) {
+        mapFlags |= MAP_POPULATE;
+    }
+    if (flags & (CHEAP_MAP_ANON | CHEAP_MAP_HUGETLB | CHEAP_MAP_THP)) {
+        mapFlags |= MAP_ANONYMOUS | (flags & CHEAP_MAP_HUGETLB ? MAP_HUGETLB : 0);
+    } else {
+        fd = open("/dev/zero", O_RDWR);
+        if (-1 == fd) {
+            fprintf(stderr, "Error:mem.c: Cannot open /dev/zero\n");
+            return NULL;
+        }
+    }
+
+    // Using mmap to allocate memory
+    mmap_ptr = mmap(addr, *size, PROT_READ | PROT_WRITE, mapFlags, fd, 0);
+    if (-1 != fd) {
+        close(fd);
+    }
+    if (MAP_FAILED == mmap_ptr) {
+        fprintf(stderr, "Error:mem.c: mmap cannot allocate space\n");
+        if (NULL != addr) { //a failed MAP_FIXED may have dropped the reservation
+            unmap_pages(addr, *size);
+        }
+        return NULL;
+    }
+
+    if (flags & CHEAP_MAP_THP) {
+        madvise(mmap_ptr, *size, MADV_HUGEPAGE);
+    }
+    if ((flags & CHEAP_MAP_LOCK) && mlock(mmap_ptr, *size) != 0) {
+        fprintf(stderr, "Error:mem.c: mlock cannot lock space\n");
+        if (NULL != addr) {
+            unmap_pages(mmap_ptr, *size);
+        } else {
+            munmap(mmap_ptr, *size);
+        }
+        return NULL;
+    }
+    return mmap_ptr;
+}
+
+/*
+ * Reserves 'size' bytes of address space without backing memory, so a
+ * growable heap can later map pages right after its end.
+ * The range starts at a multiple of 'align', a power of two page size.
+ * Returns the start of the range on success.
+ * Returns NULL on failure.
+ */
+static void* reserve_region(bsize_t size, bsize_t align) {
+    bsize_t slack = align > getpagesize() ? align : 0; //extra space so an aligned start can be picked
+    char *mmap_ptr = mmap(NULL, size + slack, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    char *aligned;
+
+    if (MAP_FAILED == mmap_ptr) {
+        fprintf(stderr, "Error:mem.c: mmap cannot reserve space\n");
+        return NULL;
+    }
+    if (slack != 0) { //give back what lies outside the aligned range
+        aligned = (char*)(((unsigned long)mmap_ptr + align - 1) & ~((unsigned long)align - 1));
+        if (aligned != mmap_ptr) {
+            munmap(mmap_ptr, aligned - mmap_ptr);
+        }
+        munmap(aligned + size, mmap_ptr + slack - aligned);
+        mmap_ptr = aligned;
+    }
+    return mmap_ptr;
+}
+
+/*
+ * Maps the region for a heap of at least '*size' bytes, rounded up to the
+ * page size. If 'maxSize' is larger, address space up to maxSize is
+ * reserved after it for growing. Huge page backed regions are always
+ * placed in a reservation so they start on a huge page boundary.
+ * Returns the start of the region on success.
+ * Returns NULL on failure.
+ */
+static void* map_heap_region(bsize_t *size, bsize_t maxSize, int flags) {
+    bsize_t pagesize = region_page_size(flags);
+    void *reserve_ptr;
+
+    if (maxSize <= *size) {
+        if (pagesize == getpagesize()) {
+            return map_region(NULL, size, flags);
+        }
+        *size = round_to(*size, pagesize);
+        maxSize = *size;
+    }
+
+    reserve_ptr = reserve_region(maxSize, pagesize);
+    if (NULL == reserve_ptr) {
+        return NULL;
+    }
+    if (NULL == map_region(reserve_ptr, size, flags)) {
+        munmap(reserve_ptr, maxSize);
+        return NULL;
+    }
+    return reserve_ptr;
+}
+
+/*
+ * Returns the block right before the end mark of 'arena'.
+ * The heap is walked since the end mark does not record the status of
+ * the block before it, this is only needed when the heap grows or shrinks.
+ */
+static blockHeader* last_block(arena_t *arena) {
+    blockHeader *currBlock = arena->heap_start;
+    blockHeader *nextBlock = (blockHeader*)((char*)currBlock + block_size(currBlock));
+
+    while(nextBlock->size_status != 1) {
+        currBlock = nextBlock;
+        nextBlock = (blockHeader*)((char*)currBlock + block_size(currBlock));
+    }
+    return currBlock;
+}
+
+/*
+ * Moves the end mark of 'arena' by 'delta' bytes and keeps alloc_size
+ * (and the global alloc_size for main_arena) in step.
+ */
+static void move_end_mark(arena_t *arena, bsize_t delta) {
+    arena->map_size += delta;
+    arena->alloc_size += delta;
+    arena->end_mark = (blockHeader*)((char*)arena->end_mark + delta);
+    arena->end_mark->size_status = 1;
+    if(arena == &main_arena) {
+        alloc_size = arena->alloc_size;
+    }
+}
+
+/*
+ * Grows the region of 'arena' so a block of 'blockSizeNeed' bytes fits.
+ * New pages are mapped into the address space reserved right after the
+ * current end, the end mark moves
+ * forward and the new space is merged with a trailing free block.
+ * Grows by at least a quarter of the current size so a run of failing
+ * allocations does not map one page at a time.
+ * Returns 0 on success.
+ * Returns -1 if the arena is fixed size or would exceed max_size.
+ */
+static int grow_arena(arena_t *arena, bsize_t blockSizeNeed) {
+    blockHeader *lastBlock = last_block(arena);
+    blockHeader *newBlock = arena->end_mark; //new space starts where the end mark was
+    bsize_t needMore = blockSizeNeed;
+    bsize_t growSize;
+
+    if(arena->max_size == 0) {
+        return -1;
+    }
+    if(!(lastBlock->size_status & 1)) { //trailing free block covers part of the request
+        needMore -= block_size(lastBlock);
+    }
+
+    growSize = arena->map_size / 4 > needMore ? arena->map_size / 4 : needMore;
+    if(growSize > arena->max_size - arena->map_size) {
+        growSize = arena->max_size - arena->map_size;
+    }
+    if(growSize < needMore) {
+        return -1;
+    }
+
+    //growSize gets rounded up to the page size, max_size is a multiple of it too
+    if(map_region((char*)arena->mmap_ptr + arena->map_size, &growSize, arena->map_flags) == NULL) {
+        return -1;
+    }
+
+    move_end_mark(arena, growSize);
+    if(lastBlock->size_status & 1) { //new space becomes a free block after an allocated one
+        newBlock->size_status = growSize | 2;
+    } else { //extend the trailing free block
+        remove_free_block(arena, lastBlock);
+        lastBlock->size_status += growSize;
+        newBlock = lastBlock;
+    }
+    write_footer(newBlock);
+    insert_free_block(arena, newBlock);
+    return 0;
+}
+
+/*
+ * Counts an allocation of 'blockSize' bytes in the stats of 'arena'.
+ */
+static void count_alloc(arena_t *arena, bsize_t blockSize) {
+    int bucket = floor_log2(blockSize) - 4;
+
+    arena->stats.allocs++;
+    arena->stats.size_hist[bucket < CHEAP_SIZE_BUCKETS ? bucket : CHEAP_SIZE_BUCKETS - 1]++;
+}
+
+/*
+ * Takes a block of 'blockSizeNeed' bytes from the free lists, growing the
+ * arena if nothing fits.
+ * Returns the header of the allocated block or NULL if there is no fit.
+ */
+static blockHeader* alloc_block(arena_t *arena, bsize_t blockSizeNeed) {
+    blockHeader *currBestFit = find_fit(arena, blockSizeNeed);
+    if(currBestFit == NULL) {
+        if(grow_arena(arena, blockSizeNeed) != 0) {
+            arena->stats.failed_allocs++;
+            return NULL;
+        }
+        currBestFit = find_fit(arena, blockSizeNeed);
+    }
+
+    remove_free_block(arena, currBestFit);
+    if(arena->region != NULL && currBestFit == (blockHeader*)((char*)arena->region + block_size(arena->region)) &&
+       block_size(currBestFit) - blockSizeNeed >= MIN_BLOCK_SIZE) {
+        //keep the free space right after the region so the region can still grow into it
+        currBestFit = place_block_high(arena, currBestFit, blockSizeNeed);
+    } else {
+        place_block(arena, currBestFit, blockSizeNeed);
+    }
+    count_alloc(arena, block_size(currBestFit));
+    return currBestFit;
+}
+
+/*
+ * Takes a block of 'blockSizeNeed' bytes whose payload starts at a multiple
+ * of 'align' (a power of two, larger than ALIGNMENT) from the free lists, growing the
+ * arena if nothing fits. The gap in front of the payload is split off as a
+ * free block of its own, so it stays usable.
+ * Returns the header of the allocated block or NULL if there is no fit.
+ */
+static blockHeader* alloc_aligned_block(arena_t *arena, bsize_t blockSizeNeed, int align) {
+    //any block this big has an aligned payload with room for a leading free block
+    bsize_t searchSize = blockSizeNeed + align + MIN_BLOCK_SIZE;
+    blockHeader *block = find_fit(arena, searchSize);
+    blockHeader *alignedBlock;
+    unsigned long payload;
+    bsize_t gap;
+
+    if(block == NULL) {
+        if(grow_arena(arena, searchSize) != 0) {
+            arena->stats.failed_allocs++;
+            return NULL;
+        }
+        block = find_fit(arena, searchSize);
+    }
+    remove_free_block(arena, block);
+
+    payload = (unsigned long)block + sizeof(blockHeader);
+    payload = (payload + align - 1) & ~((unsigned long)align - 1);
+    gap = (char*)payload - sizeof(blockHeader) - (char*)block;
+    if(gap != 0 && gap < MIN_BLOCK_SIZE) { //gap too small to be a free block, move to the next boundary
+        gap += align;
+    }
+
+    alignedBlock = block;
+    if(gap != 0) { //the gap keeps the p-bit of the original block, the aligned block follows a free block
+        alignedBlock = (blockHeader*)((char*)block + gap);
+        alignedBlock->size_status = block_size(block) - gap;
+        block->size_status = gap | (block->size_status & 2);
+        write_footer(block);
+        insert_free_block(arena, block);
+    }
+    place_block(arena, alignedBlock, blockSizeNeed);
+    count_alloc(arena, block_size(alignedBlock));
+    return alignedBlock;
+}
+
+#ifdef CHEAP_THREAD_SAFE
+/*
+ * Thread-safe mode, enabled by building with -DCHEAP_THREAD_SAFE -pthread.
+ *
+ * Every arena is protected by its own lock. On top of that every thread
+ * keeps a small cache of blocks it freed for each exact size class
+ * (up to 128 bytes). Cached blocks stay marked allocated in the heap, so
+ * balloc/bfree pairs of small blocks only touch thread local lists and the
+ * lock is taken only to refill an empty list or flush a full one.
+ * Only main_arena is cached, blocks of other arenas always take the lock.
+ */
+#define TCACHE_CLASSES EXACT_CLASSES
+#define TCACHE_COUNT 32  //blocks cached per size class
+#define TCACHE_BATCH 16  //blocks moved per refill or flush
+
+/*
+ * Cached blocks are kept in singly linked lists through their payload.
+ * The second word of the payload holds the owning cache as a key, so a
+ * double free into the cache can be caught without walking the list in
+ * the common case.
+ */
+typedef struct tcacheEntry {
+    struct tcacheEntry *next;
+    void *key;
+} tcacheEntry;
+
+typedef struct threadCache {
+    tcacheEntry *entries[TCACHE_CLASSES];
+    int counts[TCACHE_CLASSES];
+    int registered; //set once the thread exit destructor is registered
+} threadCache;
+
+static __thread threadCache tcache;
+static pthread_key_t tcache_exit_key;
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Moves up to 'count' blocks of size class 'sizeClass' from the cache back
+ * to main_arena. The caller must hold its lock.
+ */
+static void tcache_flush_class(int sizeClass, int count) {
+    tcacheEntry *entry;
+
+    while(count-- > 0 && tcache.entries[sizeClass] != NULL) {
+        entry = tcache.entries[sizeClass];
+        tcache.entries[sizeClass] = entry->next;
+        tcache.counts[sizeClass]--;
+        free_block(&main_arena, (blockHeader*)((char*)entry - sizeof(blockHeader)));
+    }
+}
+
+/*
+ * Function for returning every block cached by the calling thread to main_arena.
+ * Called automatically when a thread exits.
+ */
+void flush_thread_cache() {
+    pthread_mutex_lock(&main_arena.lock);
+    for(int i = 0; i < TCACHE_CLASSES; i++) {
+        tcache_flush_class(i, tcache.counts[i]);
+    }
+    pthread_mutex_unlock(&main_arena.lock);
+}
+
+static void tcache_exit(void *unused) {
+    (void)unused;
+    flush_thread_cache();
+}
+
+static void tcache_make_key() {
+    pthread_key_create(&tcache_exit_key, tcache_exit);
+}
+
+/*
+ * Registers the thread exit destructor the first time a thread uses its cache.
+ */
+static void tcache_register() {
+    pthread_once(&tcache_key_once, tcache_make_key);
+    pthread_setspecific(tcache_exit_key, &tcache);
+    tcache.registered = 1;
+}
+
+/*
+ * Returns a cached block of exactly 'blockSizeNeed' bytes.
+ * An empty list is refilled with a batch of blocks from the heap.
+ * Returns NULL if the heap has no block of that size left.
+ */
+static blockHeader* tcache_get(bsize_t blockSizeNeed) {
+    int sizeClass = size_class(blockSizeNeed);
+    tcacheEntry *entry;
+    blockHeader *block;
+
+    if(tcache.entries[sizeClass] == NULL) { //refill
+        if(!tcache.registered) {
+            tcache_register();
+        }
+        pthread_mutex_lock(&main_arena.lock);
+        for(int i = 0; i < TCACHE_BATCH; i++) {
+            block = alloc_block(&main_arena, blockSizeNeed);
+            if(block == NULL) {
+                break;
+            }
+            entry = (tcacheEntry*)((char*)block + sizeof(blockHeader));
+            entry->next = tcache.entries[sizeClass];
+            entry->key = &tcache;
+            tcache.entries[sizeClass] = entry;
+            tcache.counts[sizeClass]++;
+        }
+        pthread_mutex_unlock(&main_arena.lock);
+        if(tcache.entries[sizeClass] == NULL) {
+            return NULL;
+        }
+    }
+
+    entry = tcache.entries[sizeClass];
+    tcache.entries[sizeClass] = entry->next;
+    tcache.counts[sizeClass]--;
+    entry->key = NULL;
+    return (blockHeader*)((char*)entry - sizeof(blockHeader));
+}
+
+/*
+ * Puts the allocated block 'block' of 'blockSize' bytes into the calling
+ * thread's cache.
+ * A full list is flushed to the heap first.
+ * Returns 1 if the block was cached.
+ * Returns -1 if the block is already in this thread's cache.
+ */
+static int tcache_put(blockHeader *block, bsize_t blockSize) {
+    int sizeClass = size_class(blockSize);
+    tcacheEntry *entry = (tcacheEntry*)((char*)block + sizeof(blockHeader));
+
+    if(entry->key == &tcache) { //might be a double free, make sure
+        for(tcacheEntry *e = tcache.entries[sizeClass]; e != NULL; e = e->next) {
+            if(e == entry) {
+                return -1;
+            }
+        }
+    }
+
+    check_canary(block);
+    poison_payload(block);
+
+    if(tcache.counts[sizeClass] >= TCACHE_COUNT) { //flush
+        pthread_mutex_lock(&main_arena.lock);
+        tcache_flush_class(sizeClass, TCACHE_BATCH);
+        pthread_mutex_unlock(&main_arena.lock);
+    }
+    if(!tcache.registered) {
+        tcache_register();
+    }
+
+    entry->next = tcache.entries[sizeClass];
+    entry->key = &tcache;
+    tcache.entries[sizeClass] = entry;
+    tcache.counts[sizeClass]++;
+    return 1;
+}
+#endif
+
+ /*
+ * Returns the block size needed for a payload of 'size' bytes.
+ * Header and payload (and the canary in debug mode) are rounded up to a
+ * multiple of ALIGNMENT, a block must also be big enough to hold the free
+ * links and footer once freed.
+ */
+static bsize_t block_size_need(bsize_t size) {
+    bsize_t blockSizeNeed = ((sizeof(blockHeader) + size + CANARY_SIZE + ALIGNMENT - 1) / ALIGNMENT) * ALIGNMENT;
+    if(blockSizeNeed < MIN_BLOCK_SIZE) {
+        blockSizeNeed = MIN_BLOCK_SIZE;
+    }
+    return blockSizeNeed;
+}
+
+/*
+ * Checks that 'ptr' is the payload of an allocated block of 'arena'.
+ * Returns the size_status of the block's header on success.
+ * Returns -1 on failure.
+ */
+static bsize_t checked_status(arena_t *arena, void *ptr) {
+    if(ptr == NULL) {  //checks if the pointer is null
+        return -1;
+    } 
+
+    blockHeader *ptrBlock = (blockHeader*)((char*)ptr - sizeof(blockHeader)); //adjust for the header
+    //checks if the ptr is inside the heap space before its header is read, a block needs MIN_BLOCK_SIZE bytes before the end mark
+    if((char*)ptrBlock < (char*)arena->heap_start || (char*)ptrBlock > (char*)arena->end_mark - MIN_BLOCK_SIZE) {
+        return -1;
+    }
+    if((unsigned long)ptr % ALIGNMENT != 0) { //checks if the pointer is a multiple of ALIGNMENT
+        return -1;
+    } 
+    bsize_t ptrStatus = LOAD_STATUS(ptrBlock);
+    if(!(ptrStatus & 1)) { //block is already freed
+        return -1;
+    }
+    return ptrStatus;
+}
+
+/*
+ * Function for choosing how bfree coalesces in 'arena'.
+ * Argument immediate: 1 to merge on every bfree, 0 to leave it to coalesce()
+ */
+void arena_set_coalesce_mode(arena_t *arena, int immediate) {
+    arena->immediate_coalesce = immediate ? 1 : 0;
+}
+
+/*
+ * Function for choosing how bfree coalesces in the heap set up by init_heap.
+ */
+void set_coalesce_mode(int immediate) {
+    arena_set_coalesce_mode(&main_arena, immediate);
+}
+
+/*
+ * Function for choosing how balloc picks a free block in 'arena', best to
+ * call right after the arena is set up. Switching to first-fit sorts the
+ * free lists by address.
+ * Argument policy: one of the CHEAP_FIT_ policies in CHeap.h
+ * Returns 0 on success.
+ * Returns -1 if the policy is unknown.
+ */
+int arena_set_fit_policy(arena_t *arena, int policy) {
+    if(policy < CHEAP_FIT_BEST || policy > CHEAP_FIT_GOOD) {
+        return -1;
+    }
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#endif
+    if(policy == CHEAP_FIT_FIRST && arena->fit_policy != CHEAP_FIT_FIRST) {
+        rebuild_free_lists(arena);
+    }
+    arena->fit_policy = policy;
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
+    return 0;
+}
+
+/*
+ * Function for choosing the placement policy of the heap set up by
+ * init_heap, see arena_set_fit_policy.
+ */
+int set_fit_policy(int policy) {
+    return arena_set_fit_policy(&main_arena, policy);
+}
+
+#ifdef CHEAP_DEBUG
+/*
+ * Function for choosing how often the whole of 'arena' is checked in debug mode.
+ * Argument interval: heap operations between two checks, 0 turns the
+ *                    sampled checks (and the check after coalesce) off
+ */
+void arena_set_check_interval(arena_t *arena, int interval) {
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#endif
+    arena->check_interval = interval > 0 ? interval : 0;
+    arena->check_countdown = arena->check_interval;
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
+}
+
+/*
+ * Function for choosing how often the heap set up by init_heap is checked,
+ * see arena_set_check_interval.
+ */
+void set_check_interval(int interval) {
+    arena_set_check_interval(&main_arena, interval);
+}
+#endif
+
+/*
+ * Function for returning a large trailing free block of 'arena' to the OS.
+ * A growable arena unmaps the pages past the block, keeping the address
+ * space reserved, and moves the end mark back so its region shrinks and can
+ * grow again later. A fixed size arena
+ * keeps its size and drops the block's whole pages with
+ * madvise(MADV_DONTNEED), which frees the memory until it is touched again.
+ * Huge page backed arenas give back whole huge pages only. File backed
+ * arenas are left alone, dropping pages of a shared file mapping frees no
+ * memory, so trimming them returns 0.
+ * Argument pad: free bytes to keep at the end of the heap
+ * Returns the number of bytes given back to the OS.
+ */
+bsize_t arena_trim(arena_t *arena, bsize_t pad) {
+    bsize_t pagesize = region_page_size(arena->map_flags);
+    bsize_t released = 0;
+    blockHeader *lastBlock;
+    char *keepEnd;
+    char *blockEnd;
+
+    if(pad < 0) {
+        pad = 0;
+    }
+
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#endif
+    lastBlock = last_block(arena);
+    if(!(arena->map_flags & MAP_FILE_BACKED) && !(lastBlock->size_status & 1)) {
+        //first page boundary that leaves the header, links, pad and footer in place
+        keepEnd = (char*)lastBlock + MIN_BLOCK_SIZE + pad;
+        if(arena->max_size != 0) { //the region ends right after the end mark, the new end mark takes the last header
+            keepEnd += sizeof(blockHeader);
+        }
+        keepEnd = (char*)((((unsigned long)keepEnd + pagesize - 1) / pagesize) * pagesize);
+        blockEnd = (char*)arena->end_mark;
+
+        if(arena->max_size != 0) {
+            released = (char*)arena->mmap_ptr + arena->map_size - keepEnd;
+            if(released > 0) {
+                remove_free_block(arena, lastBlock);
+                //drop the pages but keep the range reserved for growing again
+                unmap_pages(keepEnd, released);
+                move_end_mark(arena, -released);
+                lastBlock->size_status -= released;
+                write_footer(lastBlock);
+                insert_free_block(arena, lastBlock);
+            } else {
+                released = 0;
+            }
+        } else {
+            //keep the page holding the footer
+            blockEnd = (char*)((((unsigned long)blockEnd - sizeof(blockHeader)) / pagesize) * pagesize);
+            if(blockEnd > keepEnd && madvise(keepEnd, blockEnd - keepEnd, MADV_DONTNEED) == 0) { //fails on locked pages
+                released = blockEnd - keepEnd;
+            }
+        }
+    }
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
+    return released;
+}
+
+/*
+ * Function for returning free memory at the end of the heap set up by
+ * init_heap to the OS, see arena_trim.
+ */
+bsize_t trim_heap(bsize_t pad) {
+    return arena_trim(&main_arena, pad);
+}
+
+/*
+ * Counts an allocation that was turned down because it can never fit in 'arena'.
+ */
+static void count_failed(arena_t *arena) {
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#endif
+    arena->stats.failed_allocs++;
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
+}
+
+/*
+ * Function for allocating 'size' bytes of memory from 'arena'.
+ * Argument size: requested size for the payload
+ * Returns address of allocated block (payload) on success.
+ * Returns NULL on failure.
+ */
+void* arena_balloc(arena_t *arena, bsize_t size) {
+    //check if size is less than 1 or if size is greater than heap size, a growable heap may get bigger
+    bsize_t heapLimit = arena->max_size > arena->alloc_size ? arena->max_size : arena->alloc_size;
+    if(size < 1) {
+    	return NULL;
+    }
+    if(size > heapLimit - (bsize_t)sizeof(blockHeader)) {
+        count_failed(arena);
+        return NULL;
+    }
+
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#endif
+    sample_check(arena);
+    blockHeader *currBestFit = alloc_block(arena, block_size_need(size));
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
+    if(currBestFit == NULL) { //no block found, null is returned
+        return NULL;
+    }
+
+    return (void*)((char*)currBestFit + sizeof(blockHeader)); //return the address of the payload
+}
+
+ /*
+ * Function for allocating 'size' bytes of heap memory.
+ * Argument size: requested size for the payload
+ * Returns address of allocated block (payload) on success.
+ * Returns NULL on failure.
+ */
+void* balloc(bsize_t size) {   
+#ifdef CHEAP_THREAD_SAFE
+    //small blocks come from this thread's cache
+    if(size >= 1 && block_size_need(size) <= EXACT_CLASS_MAX) {
+        blockHeader *block = tcache_get(block_size_need(size));
+        return block == NULL ? NULL : (void*)((char*)block + sizeof(blockHeader));
+    }
+#endif
+    return arena_balloc(&main_arena, size);
+} 
+
+/*
+ * Function for freeing up a block previously allocated from 'arena'.
+ * Same checks and return values as bfree.
+ */
+int arena_bfree(arena_t *arena, void *ptr) {
+    if(checked_status(arena, ptr) == -1) {
+        return -1;
+    }
+
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#endif
+    sample_check(arena);
+    free_block(arena, (blockHeader*)((char*)ptr - sizeof(blockHeader)));
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
+    return 0;
+}
+
+/* 
+ * Function for freeing up a previously allocated block.
+ * Argument ptr: address of the block to be freed up.
+ * Returns 0 on success.
+ * Returns -1 on failure.
+ * This function should:
+ * - Return -1 if ptr is NULL.
+ * - Return -1 if ptr is not a multiple of ALIGNMENT (8, or 16 with CHEAP_WIDE_HEADER).
+ * - Return -1 if ptr is outside of the heap space.
+ * - Return -1 if ptr block is already freed.
+ * - Update header(s) and footer as needed.
+ */                    
+int bfree(void *ptr) {   
+#ifdef CHEAP_THREAD_SAFE
+    bsize_t ptrStatus = checked_status(&main_arena, ptr);
+    if(ptrStatus == -1) {
+        return -1;
+    }
+
+    //small blocks go to this thread's cache without taking the heap lock
+    if(((ptrStatus >> 2) << 2) <= EXACT_CLASS_MAX) {
+        int cached = tcache_put((blockHeader*)((char*)ptr - sizeof(blockHeader)), (ptrStatus >> 2) << 2);
+        if(cached != 0) {
+            return cached == 1 ? 0 : -1;
+        }
+    }
+#endif
+    return arena_bfree(&main_arena, ptr);
+} 
+
+/*
+ * Function for allocating 'size' bytes from 'arena' with the payload
+ * aligned to 'alignment' bytes, e.g. 32 or 64 for SIMD data and cache line
+ * sized counters or the page size.
+ * The gap in front of the aligned payload becomes a free block of its own,
+ * so the result is an ordinary block for bfree, brealloc and disp_heap.
+ * Argument alignment: a power of two, at most the page size
+ * Argument size: requested size for the payload
+ * Returns address of allocated block (payload) on success.
+ * Returns NULL on failure.
+ */
+void* arena_balign(arena_t *arena, int alignment, bsize_t size) {
+    blockHeader *block;
+    bsize_t heapLimit = arena->max_size > arena->alloc_size ? arena->max_size : arena->alloc_size;
+
+    if(alignment <= 0 || (alignment & (alignment - 1)) != 0 || alignment > getpagesize()) {
+        return NULL;
+    }
+    if(alignment <= ALIGNMENT) { //every payload is aligned this much already
+        return arena_balloc(arena, size);
+    }
+    if(size < 1) {
+        return NULL;
+    }
+    if(size > heapLimit - alignment - MIN_BLOCK_SIZE - (int)sizeof(blockHeader)) {
+        count_failed(arena);
+        return NULL;
+    }
+
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#endif
+    sample_check(arena);
+    block = alloc_aligned_block(arena, block_size_need(size), alignment);
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
+    if(block == NULL) {
+        return NULL;
+    }
+    return (void*)((char*)block + sizeof(blockHeader));
+}
+
+/*
+ * Function for allocating an aligned block from the heap set up by
+ * init_heap, see arena_balign.
+ */
+void* balign(int alignment, bsize_t size) {
+    return arena_balign(&main_arena, alignment, size);
+}
+
+/*
+ * posix_memalign style wrapper around balign.
+ * Returns 0 and stores the payload in *memptr on success.
+ * Returns -1 on failure.
+ */
+int bmemalign(void **memptr, int alignment, bsize_t size) {
+    void *ptr = balign(alignment, size);
+    if(ptr == NULL) {
+        return -1;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+/*
+ * Function for resizing a block previously allocated from 'arena'.
+ * The block shrinks in place by splitting off its tail. It grows in place
+ * when the next block is free and big enough, or when it is the last block
+ * of a growable arena. Only if neither works is a new block allocated and
+ * the payload copied.
+ * Argument ptr: address of the block, NULL allocates a new block
+ * Argument size: new size for the payload, 0 frees the block
+ * Returns address of the resized block (payload) on success.
+ * Returns NULL on failure, the old block is left untouched.
+ */
+void* arena_brealloc(arena_t *arena, void *ptr, bsize_t size) {
+    blockHeader *block;
+    blockHeader *nextBlock;
+    blockHeader *newBlock;
+    bsize_t blockSize;
+    bsize_t blockSizeNeed;
+    bsize_t heapLimit = arena->max_size > arena->alloc_size ? arena->max_size : arena->alloc_size;
+
+    if(ptr == NULL) {
+        return arena_balloc(arena, size);
+    }
+    if(checked_status(arena, ptr) == -1 || size < 0) {
+        return NULL;
+    }
+    if(size == 0) {
+        arena_bfree(arena, ptr);
+        return NULL;
+    }
+    if(size > heapLimit - (bsize_t)sizeof(blockHeader)) { //would overflow block_size_need, can never fit
+        count_failed(arena);
+        return NULL;
+    }
+
+    block = (blockHeader*)((char*)ptr - sizeof(blockHeader));
+    blockSize = block_size(block);
+    blockSizeNeed = block_size_need(size);
+
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#endif
+    sample_check(arena);
+    check_canary(block);
+    nextBlock = (blockHeader*)((char*)block + blockSize);
+    if(blockSizeNeed > blockSize && arena->max_size != 0 &&
+       (nextBlock == arena->end_mark || (!(nextBlock->size_status & 1) &&
+        (blockHeader*)((char*)nextBlock + block_size(nextBlock)) == arena->end_mark &&
+        blockSize + block_size(nextBlock) < blockSizeNeed))) {
+        //last block of a growable arena, grow the heap so the next block is big enough
+        grow_arena(arena, blockSizeNeed - blockSize);
+    }
+
+    if(nextBlock->size_status != 1 && !(nextBlock->size_status & 1) &&
+       (blockSizeNeed <= blockSize || blockSize + block_size(nextBlock) >= blockSizeNeed)) {
+        //take the free next block, place_block gives back what is not needed
+        remove_free_block(arena, nextBlock);
+        block->size_status = (blockSize + block_size(nextBlock)) | (block->size_status & 2);
+        place_block(arena, block, blockSizeNeed);
+    } else if(blockSizeNeed <= blockSize) {
+        //shrink, the next block is allocated (or the end mark) so its p-bit must be cleared if a tail is split off
+        block->size_status &= ~1;
+        place_block(arena, block, blockSizeNeed);
+        if(block_size(block) != blockSize && nextBlock->size_status != 1) {
+            CLEAR_PBIT(nextBlock);
+        }
+    } else {
+        //last resort, move the payload to a new block
+        newBlock = alloc_block(arena, blockSizeNeed);
+        if(newBlock == NULL) {
+#ifdef CHEAP_THREAD_SAFE
+            pthread_mutex_unlock(&arena->lock);
+#endif
+            return NULL;
+        }
+        memcpy((char*)newBlock + sizeof(blockHeader), ptr, blockSize - sizeof(blockHeader) - CANARY_SIZE);
+        free_block(arena, block);
+        block = newBlock;
+    }
+    arena->stats.reallocs++;
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
+
+    return (void*)((char*)block + sizeof(blockHeader));
+}
+
+/*
+ * Function for resizing a block previously allocated by balloc, see arena_brealloc.
+ */
+void* brealloc(void *ptr, bsize_t size) {
+    return arena_brealloc(&main_arena, ptr, size);
+}
+
+/*
+ * Slab allocator for small fixed size objects.
+ *
+ * A slab is a heap block whose payload is one SLAB_SIZE aligned page.
+ * The page starts with a slab_t followed by objects of a single size, so
+ * objects carry no header or padding and sfree finds the slab of an object
+ * by rounding its address down to SLAB_SIZE. A bitmap records which objects
+ * are allocated. Slabs with free objects are kept on a partial list per
+ * object size, full slabs are moved to a full list, and a slab that becomes
+ * empty is given back to the heap unless it is the last partial one.
+ */
+#define SLAB_SIZE 4096
+#define SLAB_MAGIC 0x51ab51ab
+#define SLAB_BITMAP_WORDS (SLAB_SIZE / SLAB_MIN_OBJ / 64)
+
+typedef struct slab {
+    unsigned int magic;   //SLAB_MAGIC, tells sfree it was given a slab object
+    int obj_size;
+    int capacity;         //number of objects in the slab
+    int in_use;           //number of allocated objects
+    int first_obj;        //offset of the first object from the start of the slab
+    struct slab *next;
+    struct slab *prev;
+    unsigned long long used[SLAB_BITMAP_WORDS]; //bit i is set when object i is allocated
+} slab_t;
+
+/*
+ * Returns the slab class of an object of 'size' bytes or -1 if it is too big.
+ */
+static int slab_class(int size) {
+    int slabClass = 0;
+    int objSize = SLAB_MIN_OBJ;
+
+    while(objSize < size) {
+        objSize <<= 1;
+        slabClass++;
+    }
+    return slabClass < SLAB_CLASSES ? slabClass : -1;
+}
+
+static void slab_push(slab_t **list, slab_t *slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if(slab->next != NULL) {
+        slab->next->prev = slab;
+    }
+    *list = slab;
+}
+
+static void slab_unlink(slab_t **list, slab_t *slab) {
+    if(slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        *list = slab->next;
+    }
+    if(slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    }
+}
+
+/*
+ * Carves a new slab for objects of slab class 'slabClass' out of 'arena'
+ * and puts it on the partial list.
+ * Returns the slab or NULL if the heap has no room for it.
+ */
+static slab_t* new_slab(arena_t *arena, int slabClass) {
+    blockHeader *block = alloc_aligned_block(arena, block_size_need(SLAB_SIZE), SLAB_SIZE);
+    slab_t *slab;
+    int objSize = SLAB_MIN_OBJ << slabClass;
+    int objAlign = objSize < 64 ? objSize : 64; //keep objects inside as few cache lines as possible
+
+    if(block == NULL) {
+        return NULL;
+    }
+    slab = (slab_t*)((char*)block + sizeof(blockHeader));
+    memset(slab, 0, sizeof(slab_t));
+    slab->magic = SLAB_MAGIC;
+    slab->obj_size = objSize;
+    slab->first_obj = ((sizeof(slab_t) + objAlign - 1) / objAlign) * objAlign;
+    slab->capacity = (SLAB_SIZE - slab->first_obj) / objSize;
+    slab_push(&arena->slab_partial[slabClass], slab);
+    return slab;
+}
+
+/*
+ * Function for allocating a small object of 'size' bytes from a slab of 'arena'.
+ * Argument size: requested size, at most SLAB_MAX_OBJ bytes
+ * Returns address of the object on success.
+ * Returns NULL on failure.
+ */
+void* arena_salloc(arena_t *arena, int size) {
+    int slabClass;
+    int word;
+    int bit;
+    slab_t *slab;
+
+    if(size < 1 || (slabClass = slab_class(size)) == -1) {
+        return NULL;
+    }
+
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#endif
+    slab = arena->slab_partial[slabClass];
+    if(slab == NULL) {
+        slab = new_slab(arena, slabClass);
+        if(slab == NULL) {
+#ifdef CHEAP_THREAD_SAFE
+            pthread_mutex_unlock(&arena->lock);
+#endif
+            return NULL;
+        }
+    }
+
+    //partial slabs always have a clear bit below capacity
+    for(word = 0; ~slab->used[word] == 0; word++) {
+    }
+    bit = __builtin_ctzll(~slab->used[word]);
+    slab->used[word] |= 1ULL << bit;
+    slab->in_use++;
+    if(slab->in_use == slab->capacity) {
+        slab_unlink(&arena->slab_partial[slabClass], slab);
+        slab_push(&arena->slab_full[slabClass], slab);
+    }
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
+
+    return (char*)slab + slab->first_obj + (word * 64 + bit) * slab->obj_size;
+}
+
+/*
+ * Function for allocating a small object from a slab of the heap set up by init_heap.
+ */
+void* salloc(int size) {
+    return arena_salloc(&main_arena, size);
+}
+
+/*
+ * Function for freeing an object allocated by arena_salloc.
+ * Returns 0 on success.
+ * Returns -1 if ptr is NULL, outside of the heap, not an object of a slab
+ * or already freed.
+ */
+int arena_sfree(arena_t *arena, void *ptr) {
+    slab_t *slab = (slab_t*)((unsigned long)ptr & ~((unsigned long)SLAB_SIZE - 1));
+    int slabClass;
+    int index;
+    int offset;
+    int result = -1;
+
+    if(ptr == NULL) {
+        return -1;
+    }
+
+    //another thread may give the slab back and reuse its page, so it is only read under the lock
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#endif
+    if((char*)ptr >= (char*)arena->heap_start && (char*)ptr < (char*)arena->end_mark &&
+       (char*)slab >= (char*)arena->heap_start && slab->magic == SLAB_MAGIC) {
+        offset = (char*)ptr - (char*)slab - slab->first_obj;
+        index = offset / slab->obj_size;
+        if(offset >= 0 && offset % slab->obj_size == 0 && index < slab->capacity &&
+           (slab->used[index / 64] & (1ULL << (index % 64)))) { //not freed yet
+            slabClass = slab_class(slab->obj_size);
+            if(slab->in_use == slab->capacity) { //full slab gets a free object
+                slab_unlink(&arena->slab_full[slabClass], slab);
+                slab_push(&arena->slab_partial[slabClass], slab);
+            }
+            slab->used[index / 64] &= ~(1ULL << (index % 64));
+            slab->in_use--;
+
+            //give an empty slab back to the heap, unless it is the only one left for its size
+            if(slab->in_use == 0 && (slab->prev != NULL || slab->next != NULL)) {
+                slab_unlink(&arena->slab_partial[slabClass], slab);
+                slab->magic = 0;
+                free_block(arena, (blockHeader*)((char*)slab - sizeof(blockHeader)));
+            }
+            result = 0;
+        }
+    }
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
+    return result;
+}
+
+/*
+ * Function for freeing an object allocated by salloc.
+ */
+int sfree(void *ptr) {
+    return arena_sfree(&main_arena, ptr);
+}
+
+/*
+ * Function for getting the occupancy of every slab of 'arena'.
+ * Argument stats: array that receives one entry per slab
+ * Argument maxSlabs: number of entries stats has room for
+ * Returns the total number of slabs, which may be more than maxSlabs.
+ */
+int arena_slab_stats(arena_t *arena, slabStats *stats, int maxSlabs) {
+    int count = 0;
+    slab_t *lists[2];
+
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#endif
+    for(int i = 0; i < SLAB_CLASSES; i++) {
+        lists[0] = arena->slab_partial[i];
+        lists[1] = arena->slab_full[i];
+        for(int l = 0; l < 2; l++) {
+            for(slab_t *slab = lists[l]; slab != NULL; slab = slab->next) {
+                if(count < maxSlabs) {
+                    stats[count].slab = slab;
+                    stats[count].obj_size = slab->obj_size;
+                    stats[count].capacity = slab->capacity;
+                    stats[count].in_use = slab->in_use;
+                }
+                count++;
+            }
+        }
+    }
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
+    return count;
+}
+
+/*
+ * Function to be used for DEBUGGING to print the occupancy of every slab
+ * of 'arena'.
+ */
+void arena_disp_slabs(arena_t *arena) {
+    slabStats stats[64];
+    int count = arena_slab_stats(arena, stats, 64);
+
+    fprintf(stdout, 
+	"*********************************** Slab List ***********************************\n");
+    fprintf(stdout, "No.\tObjSize\tInUse\tCap\tOccup.\tt_Begin\n");
+    fprintf(stdout, 
+	"---------------------------------------------------------------------------------\n");
+    for(int i = 0; i < count && i < 64; i++) {
+        fprintf(stdout, "%d\t%d\t%d\t%d\t%5.1f%%\t0x%08lx\n", i + 1, stats[i].obj_size,
+        stats[i].in_use, stats[i].capacity, 100.0 * stats[i].in_use / stats[i].capacity,
+        (unsigned long int)stats[i].slab);
+    }
+    if(count > 64) {
+        fprintf(stdout, "... %d more slabs\n", count - 64);
+    }
+    fprintf(stdout, 
+	"*********************************************************************************\n");
+    fflush(stdout);
+}
+
+/*
+ * Function to be used for DEBUGGING to print the slabs of the heap set up by init_heap.
+ */
+void disp_slabs() {
+    arena_disp_slabs(&main_arena);
+}
+
+/*
+ * Region mode for request scoped memory.
+ *
+ * region_begin turns the start of the free block at the top of the heap
+ * into a single allocated region block. ralloc hands out objects from it by
+ * bumping region_ptr, objects carry no header and cannot be passed to bfree.
+ * The region block only covers what ralloc has handed out, it grows into
+ * the free block right after it when it runs full. balloc takes blocks from
+ * the top end of that free block so the room stays next to the region, the
+ * region cannot grow past an allocated block. region_mark remembers
+ * region_ptr and region_release puts it back, which frees everything
+ * allocated after the mark at once and gives the space back as one free
+ * block. region_end gives the whole region block back. balloc and bfree
+ * keep working on the rest of the heap while a region is open.
+ */
+
+/*
+ * Shrinks the region block of 'arena' so it ends right after 'end', the
+ * rest becomes a free block merged with a free block that follows it.
+ * Nothing is split off if the rest would be smaller than MIN_BLOCK_SIZE.
+ */
+static void region_trim(arena_t *arena, char *end) {
+    blockHeader *region = arena->region;
+    bsize_t blockSize = block_size(region);
+    bsize_t keep = ((end - (char*)region + CANARY_SIZE + ALIGNMENT - 1) / ALIGNMENT) * ALIGNMENT;
+    blockHeader *rest;
+    blockHeader *nextBlock;
+
+    if(keep < MIN_BLOCK_SIZE) {
+        keep = MIN_BLOCK_SIZE;
+    }
+    if(blockSize - keep < MIN_BLOCK_SIZE) {
+        return;
+    }
+    region->size_status = keep | (region->size_status & 3);
+    write_canary(region);
+
+    rest = (blockHeader*)((char*)region + keep);
+    rest->size_status = (blockSize - keep) | 2; //previous block is the region
+    nextBlock = (blockHeader*)((char*)region + blockSize);
+    if(nextBlock->size_status != 1) {
+        CLEAR_PBIT(nextBlock);
+    }
+    rest = merge_neighbours(arena, rest);
+    write_footer(rest);
+    insert_free_block(arena, rest);
+}
+
+/*
+ * Makes the region block of 'arena' end at least 'need' bytes after
+ * region_ptr by taking the free block that follows it, growing the arena
+ * first if the region is the last block. What is not needed is split off
+ * again.
+ * Returns 0 on success.
+ * Returns -1 if the next block is allocated or the arena cannot grow.
+ */
+static int region_extend(arena_t *arena, bsize_t need) {
+    blockHeader *region = arena->region;
+    blockHeader *nextBlock;
+
+    while(arena->region_ptr + need > (char*)region + block_size(region) - CANARY_SIZE) {
+        nextBlock = (blockHeader*)((char*)region + block_size(region));
+        if(nextBlock == arena->end_mark) { //grow, the new space becomes a free block after the region
+            if(grow_arena(arena, arena->region_ptr + need - (char*)nextBlock) != 0) {
+                region_trim(arena, arena->region_ptr);
+                return -1;
+            }
+        }
+        if(nextBlock->size_status & 1) {
+            region_trim(arena, arena->region_ptr);
+            return -1;
+        }
+        remove_free_block(arena, nextBlock);
+        region->size_status += block_size(nextBlock);
+        nextBlock = (blockHeader*)((char*)region + block_size(region));
+        if(nextBlock != arena->end_mark) {
+            SET_PBIT(nextBlock);
+        }
+    }
+    write_canary(region);
+    region_trim(arena, arena->region_ptr + need);
+    return 0;
+}
+
+/*
+ * Function for opening a region at the top of 'arena'.
+ * The region starts at the free block before the end mark and takes only
+ * a minimum size block of it, a growable arena grows when the last block
+ * is allocated or the region runs full.
+ * Returns 0 on success.
+ * Returns -1 if a region is already open or there is no space for one.
+ */
+int arena_region_begin(arena_t *arena) {
+    blockHeader *lastBlock;
+    int result = -1;
+
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#endif
+    if(arena->region == NULL) {
+        lastBlock = last_block(arena);
+        if((lastBlock->size_status & 1) && grow_arena(arena, MIN_BLOCK_SIZE) == 0) {
+            lastBlock = (blockHeader*)((char*)lastBlock + block_size(lastBlock));
+        }
+        if(!(lastBlock->size_status & 1)) {
+            remove_free_block(arena, lastBlock);
+            lastBlock->size_status += 1; //the next block is the end mark, no p-bit to set
+            write_canary(lastBlock);
+            arena->region = lastBlock;
+            arena->region_ptr = (char*)lastBlock + sizeof(blockHeader);
+            region_trim(arena, arena->region_ptr);
+            count_alloc(arena, block_size(lastBlock)); //arena_region_end counts it as a free
+            result = 0;
+        }
+    }
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
+    return result;
+}
+
+/*
+ * Function for allocating 'size' bytes from the open region of 'arena'.
+ * Argument size: requested size, rounded up to keep objects aligned
+ * Returns address of the object on success.
+ * Returns NULL on failure.
+ */
+void* arena_ralloc(arena_t *arena, bsize_t size) {
+    char *ptr = NULL;
+    bsize_t need = ((size + ALIGNMENT - 1) / ALIGNMENT) * ALIGNMENT;
+
+    if(size < 1) {
+        return NULL;
+    }
+
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#endif
+    if(arena->region != NULL) {
+        if(arena->region_ptr + need <= (char*)arena->region + block_size(arena->region) - CANARY_SIZE ||
+           region_extend(arena, need) == 0) {
+            ptr = arena->region_ptr;
+            arena->region_ptr += need;
+        }
+    }
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
+    return ptr;
+}
+
+/*
+ * Function for marking the current position of the open region of 'arena'.
+ * Returns the mark to pass to arena_region_release.
+ * Returns NULL if no region is open.
+ */
+void* arena_region_mark(arena_t *arena) {
+    return arena->region != NULL ? arena->region_ptr : NULL;
+}
+
+/*
+ * Function for freeing every object allocated from the region of 'arena'
+ * after 'mark' was taken. Takes constant time, the space after the mark
+ * goes back to the heap as one free block.
+ * Returns 0 on success.
+ * Returns -1 if no region is open or the mark does not belong to it.
+ */
+int arena_region_release(arena_t *arena, void *mark) {
+    int result = -1;
+
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#endif
+    if(arena->region != NULL && (char*)mark >= (char*)arena->region + sizeof(blockHeader) &&
+       (char*)mark <= arena->region_ptr) {
+        arena->region_ptr = mark;
+        region_trim(arena, arena->region_ptr);
+        result = 0;
+    }
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
+    return result;
+}
+
+/*
+ * Function for closing the region of 'arena'. Every object in it is freed
+ * and the region block goes back to the free lists as one free block.
+ * Returns 0 on success.
+ * Returns -1 if no region is open.
+ */
+int arena_region_end(arena_t *arena) {
+    int result = -1;
+
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#endif
+    if(arena->region != NULL) {
+        free_block(arena, arena->region);
+        arena->region = NULL;
+        arena->region_ptr = NULL;
+        result = 0;
+    }
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
+    return result;
+}
+
+/*
+ * Region functions for the heap set up by init_heap, see arena_region_begin.
+ */
+int region_begin() {
+    return arena_region_begin(&main_arena);
+}
+
+void* ralloc(bsize_t size) {
+    return arena_ralloc(&main_arena, size);
+}
+
+void* region_mark() {
+    return arena_region_mark(&main_arena);
+}
+
+int region_release(void *mark) {
+    return arena_region_release(&main_arena, mark);
+}
+
+int region_end() {
+    return arena_region_end(&main_arena);
+}
+
+/*
+ * Function for traversing the block list of 'arena' and coalescing all
+ * adjacent free blocks.
+ *
+ * This function is used for delayed coalescing.
+ * In thread-safe mode the calling thread's cache is flushed first when
+ * 'arena' is main_arena.
+ * With immediate coalescing enabled there is nothing left for it to merge.
+ * Updated header size_status and footer size_status as needed.
+ * Merged blocks are taken off their free lists and the result is put back
+ * on the list of its new size class.
+ */
+int arena_coalesce(arena_t *arena) {
+    blockHeader *currCoalBlock = arena->heap_start; //start of the heap 
+    blockHeader *nextCoalBlock;
+
+    int counter = 0; //used to keep track of the number of coalesced blocks 
+    bsize_t currCoalShifted; //size of block without a and p bit
+
+#ifdef CHEAP_THREAD_SAFE
+    if(arena == &main_arena) {
+        flush_thread_cache(); //let this thread's cached blocks take part
+    }
+    pthread_mutex_lock(&arena->lock);
+#endif
+    while(currCoalBlock->size_status != 1) {
+        currCoalShifted = block_size(currCoalBlock);
+        nextCoalBlock = (blockHeader*)((char*)currCoalBlock + currCoalShifted); //next block 
+
+        //current block is allocated or the next block is allocated or the end of the heap
+        if((currCoalBlock->size_status & 1) || nextCoalBlock->size_status == 1 || (nextCoalBlock->size_status & 1)) {
+            currCoalBlock = nextCoalBlock; //set the current block to the next block
+            continue;
+        }
+
+        //both currBlock and nextBlock are free, merge the whole run of free blocks into currBlock
+        remove_free_block(arena, currCoalBlock);
+        while(nextCoalBlock->size_status != 1 && !(nextCoalBlock->size_status & 1)) {
+            remove_free_block(arena, nextCoalBlock);
+            currCoalBlock->size_status += block_size(nextCoalBlock); //current block is now current + next block, coalesced
+            currCoalShifted = block_size(currCoalBlock);
+            nextCoalBlock = (blockHeader*)((char*)currCoalBlock + currCoalShifted);
+            counter++; //blocks have been coalesced, we can now return 1 when while loop exited
+        }
+        write_footer(currCoalBlock);
+        insert_free_block(arena, currCoalBlock);
+        currCoalBlock = nextCoalBlock;
+    }
+    arena->stats.coalesced += counter;
+#ifdef CHEAP_DEBUG
+    if(arena->check_interval > 0) {
+        verify_heap(arena, 0); //nothing may be left to merge
+    }
+#endif
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
+
+    if(counter < 1){ //if no blocks were coalesced 
+        return 0;
+    } else { //else blocks were coalesced
+        return 1;
+    }
+}
+
+/*
+ * Function for traversing heap block list and coalescing all adjacent 
+ * free blocks.
+ *
+ * This function is used for delayed coalescing.
+ * Updated header size_status and footer size_status as needed.
+ */
+int coalesce() {
+    return arena_coalesce(&main_arena);
+}
+
+/*
+ * Lays out the heap of 'arena' in the mapped region 'mmap_ptr' of 'map_size'
+ * bytes. The first 'offset' bytes of the region are skipped, offset must be
+ * a multiple of ALIGNMENT.
+ */
+static void init_arena_region(arena_t *arena, void *mmap_ptr, bsize_t map_size, int offset) {
+    arena->mmap_ptr = mmap_ptr;
+    arena->map_size = map_size;
+
+    // for payload alignment and end mark
+    arena->alloc_size = map_size - offset - ALIGNMENT;
+
+    // Initially there is only one big free block in the heap.
+    // Skip the first ALIGNMENT - header bytes so payloads are aligned.
+    arena->heap_start = (blockHeader*)((char*)mmap_ptr + offset + ALIGNMENT - sizeof(blockHeader));
+
+    // Set the end mark
+    arena->end_mark = (blockHeader*)((char*)arena->heap_start + arena->alloc_size);
+    arena->end_mark->size_status = 1;
+
+    // Set size in header
+    arena->heap_start->size_status = arena->alloc_size;
+
+    // Set p-bit as allocated in header
+    // note a-bit left at 0 for free
+    arena->heap_start->size_status += 2;
+
+    // Set the footer
+    write_footer(arena->heap_start);
+
+    // The whole heap is the only free block
+    insert_free_block(arena, arena->heap_start);
+}
+ 
+/* 
+ * Function used to initialize the memory allocator with a heap that can
+ * grow when no free block fits, backed as chosen by 'flags'.
+ * Intended to be called ONLY once by a program.
+ * Argument sizeOfRegion: the size of the heap space to be allocated.
+ * Argument maxSize: the size the heap space may grow to, if it is not
+ *                   larger than sizeOfRegion the heap never grows
+ * Argument flags: CHEAP_MAP_ flags, 0 for /dev/zero backed 4 KiB pages
+ * Returns 0 on success.
+ * Returns -1 on failure.
+ */
+int init_heap_opts(bsize_t sizeOfRegion, bsize_t maxSize, int flags) {
+ 
+    static int allocated_once = 0; //prevent multiple myInit calls
+ 
+    void* mmap_ptr; // pointer to memory mapped area
+    bsize_t map_size = sizeOfRegion;
+  
+    if (0 != allocated_once) {
+        fprintf(stderr, 
+        "Error:mem.c: InitHeap has allocated space during a previous call\n");
+        return -1;
+    }
+
+    if (sizeOfRegion <= 0) {
+        fprintf(stderr, "Error:mem.c: Requested block size is not positive\n");
+        return -1;
+    }
+
+    maxSize = maxSize > sizeOfRegion ? round_to(maxSize, region_page_size(flags)) : 0;
+    mmap_ptr = map_heap_region(&map_size, maxSize, flags);
+    if (NULL == mmap_ptr) {
+        return -1;
+    }
+  
+    allocated_once = 1;
+
+    main_arena.map_flags = flags;
+    main_arena.max_size = maxSize > map_size ? maxSize : 0;
+    init_arena_region(&main_arena, mmap_ptr, map_size, 0);
+    heap_start = main_arena.heap_start;
+    alloc_size = main_arena.alloc_size;
+  
+    return 0;
+} 
+
+/* 
+ * Function used to initialize the memory allocator with a heap that can
+ * grow when no free block fits, see init_heap_opts.
+ */
+int init_heap_growable(bsize_t sizeOfRegion, bsize_t maxSize) {
+    return init_heap_opts(sizeOfRegion, maxSize, 0);
+}
 
-/* Size of heap allocation padded to round to nearest page size.
+/* 
+ * Function used to initialize the memory allocator.
+ * Intended to be called ONLY once by a program.
+ * Argument sizeOfRegion: the size of the heap space to be allocated.
+ * Returns 0 on success.
+ * Returns -1 on failure.
+ */                    
+int init_heap(bsize_t sizeOfRegion) {    
+    return init_heap_growable(sizeOfRegion, 0);
+} 
+
+/*
+ * Function for creating an independent arena that can grow when no free
+ * block fits, backed as chosen by 'flags'.
+ * Can be called any number of times, each arena gets its own mapped region.
+ * Argument sizeOfRegion: the size of the heap space to be allocated.
+ * Argument maxSize: the size the heap space may grow to, if it is not
+ *                   larger than sizeOfRegion the arena never grows
+ * Argument flags: CHEAP_MAP_ flags, 0 for /dev/zero backed 4 KiB pages
+ * Returns the new arena on success.
+ * Returns NULL on failure.
  */
-int alloc_size;
+arena_t* arena_create_opts(bsize_t sizeOfRegion, bsize_t maxSize, int flags) {
+    int offset = ((sizeof(arena_t) + ALIGNMENT - 1) / ALIGNMENT) * ALIGNMENT; //the arena itself lives at the start of the region
+    bsize_t map_size;
+    void *mmap_ptr;
+    arena_t *arena;
+
+    if (sizeOfRegion <= 0 || sizeOfRegion > BSIZE_MAX - offset - getpagesize()) {
+        fprintf(stderr, "Error:mem.c: Requested block size is not positive\n");
+        return NULL;
+    }
+    if (maxSize > BSIZE_MAX - offset - getpagesize()) {
+        maxSize = BSIZE_MAX - offset - getpagesize();
+    }
+
+    map_size = sizeOfRegion + offset;
+    maxSize = maxSize > sizeOfRegion ? round_to(maxSize + offset, region_page_size(flags)) : 0;
+    mmap_ptr = map_heap_region(&map_size, maxSize, flags);
+    if (NULL == mmap_ptr) {
+        return NULL;
+    }
+
+    arena = (arena_t*)mmap_ptr; //region is zero filled, so the free lists start out empty
+    arena->immediate_coalesce = CHEAP_IMMEDIATE_COALESCE;
+    arena->fit_policy = CHEAP_FIT_POLICY;
+#ifdef CHEAP_DEBUG
+    arena->check_interval = arena->check_countdown = CHEAP_CHECK_INTERVAL;
+#endif
+    arena->map_flags = flags;
+    arena->max_size = maxSize > map_size ? maxSize : 0;
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_init(&arena->lock, NULL);
+#endif
+    init_arena_region(arena, mmap_ptr, map_size, offset);
+    return arena;
+}
 
 /*
- * Additional global variables may be added as needed below
+ * Function for creating an independent arena that can grow when no free
+ * block fits, see arena_create_opts.
  */
+arena_t* arena_create_growable(bsize_t sizeOfRegion, bsize_t maxSize) {
+    return arena_create_opts(sizeOfRegion, maxSize, 0);
+}
 
- /*
- * Function for allocating 'size' bytes of heap memory.
- * Argument size: requested size for the payload
- * Returns address of allocated block (payload) on success.
+/*
+ * Function for creating an independent fixed size arena.
+ * Can be called any number of times, each arena gets its own mapped region.
+ * Argument sizeOfRegion: the size of the heap space to be allocated.
+ * Returns the new arena on success.
  * Returns NULL on failure.
  */
-void* balloc(int size) {   
-    //check if size is less than 1 or if size is greater than heap size
-    if(size < 1 || size + sizeof(blockHeader) > alloc_size) {
-    	return NULL;
+arena_t* arena_create(bsize_t sizeOfRegion) {
+    return arena_create_growable(sizeOfRegion, 0);
+}
+
+/*
+ * Function for releasing an arena made by arena_create together with every
+ * block still allocated in it. A file backed arena is only unmapped, its
+ * file keeps the heap.
+ * Returns 0 on success.
+ * Returns -1 on failure.
+ */
+int arena_destroy(arena_t *arena) {
+    if (arena == NULL || arena == &main_arena) {
+        return -1;
     }
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_destroy(&arena->lock);
+#endif
+    //a growable arena also releases the address space it reserved
+    return munmap(arena->mmap_ptr, arena->max_size > arena->map_size ? arena->max_size : arena->map_size);
+}
 
-    //const variables for header and padding size so they can't be changed and then add them all into blockSize for true size of block that will be allocated
-    int const hdrSize = sizeof(blockHeader);
-    int blockPayload = size;
-    int const blockPadding = (8 - ((hdrSize + blockPayload) % 8));
-    int blockSizeNeed = hdrSize + blockPayload + blockPadding;
-
-    blockHeader *currBlock = heap_start; //start of the heap
-    blockHeader *currBestFit = NULL; //used when there isn't a perfect fit and need to keep track of current best fit
-    blockHeader *splitBlock = NULL; //used in case of a non perfect fit
-    blockHeader *nextBlock = NULL; //used to get the next block
-
-    //variables used in the while loop below
-    int currBlockSize;
-    int currBestFitSize = 2000000000; //used to track size of current best fit 
-    int splitFit = 0; //used to keep track if there has been a non perfect fit found
-    int currShifted;
-    int prevPBit = 0; //used to keep track of p bit for block in case of non perfect block found
-
-    //while loop to loop through the entire heap looking for a block
-    while (currBlock->size_status != 1) {
-        currBlockSize = currBlock->size_status; //size of current block including the p and a bit
-        currShifted = (currBlockSize >> 2) << 2; //get rid of the p and a bit so it doesn't affect address arithmetic 
-
-        if(currBlockSize & 1) { //block is allocated
-            currBlock = (blockHeader*)((char*)currBlock + currShifted);
-            continue; //continue going through while loop 
-        } else { //block is free
-            if(currShifted == blockSizeNeed) { //perfect fit, exit while loop
-                currBestFit = currBlock;
-                currBestFit->size_status = currShifted;
-                currBestFit->size_status += 1; //a bit
-                if(currBlockSize & 2) { //checks for p bit
-                    currBestFit->size_status += 2; //add p bit if there is 
-                }
-                nextBlock = (blockHeader*)((char*)currBlock + currShifted); 
-                nextBlock->size_status += 2; //set p bit of the next block
-                return ((void*)currBestFit) + sizeof(blockHeader); //return the address of the payload
-            } else if(currShifted > blockSizeNeed) {//not a perfect fit
-                if(currShifted < currBestFitSize) { //checks if currBlockSize is less than previous best fit size
-                    if(currBlockSize & 2){ //checks for the p bit that will be used after while loop
-                        prevPBit = 1;
-                    } else {
-                        prevPBit = 0;
-                    }
-                    currBestFit = currBlock;
-                    currBestFitSize = currShifted;
-                    if(!splitFit) { //checks if there has been a block found yet
-                        splitFit = 1;
-                    }
-                }
-                currBlock = (blockHeader*)((char*)currBlock + currShifted); //continue to loop through the while loop
-                continue;
-            }
-            currBlock = (blockHeader*)((char*)currBlock + currShifted); //to stop infinite loops, if the currBlockSize does not meet any of the if statements
-            continue;
-        }
+/*
+ * File backed arenas.
+ *
+ * arena_open_file maps a regular file MAP_SHARED as the region of an arena,
+ * so the heap and everything allocated in it outlive the process. The file
+ * starts with a superblock, followed by the arena and its heap:
+ *
+ *   | superblock | arena_t | heap_start ... end mark |
+ *
+ * Block headers, free links and the arena itself hold plain pointers, so
+ * the file is always mapped at the address recorded in the superblock.
+ * A process reattaches by opening the same file, finds its data through
+ * the root pointer and carries on allocating. The free lists are rebuilt
+ * and the heap is checked at attach, so a heap that was not checkpointed
+ * cleanly is refused instead of corrupting new allocations.
+ */
+#define CHEAP_FILE_MAGIC 0x43486561704669ULL //"CHeapFi"
+#define CHEAP_FILE_VERSION 1
+
+typedef struct superblock {
+    unsigned long long magic;   //CHEAP_FILE_MAGIC
+    int version;                //CHEAP_FILE_VERSION
+    int header_size;            //sizeof(blockHeader), the two header layouts cannot read each other
+    int arena_size;             //sizeof(arena_t), differs with CHEAP_THREAD_SAFE
+    int offset;                 //start of the heap layout after the superblock and arena
+    void *base;                 //address the file must be mapped at
+    bsize_t file_size;
+    void *root;                 //entry point to the data kept in the heap
+} superblock;
+
+/*
+ * Returns the superblock of 'arena' or NULL if it is not file backed.
+ */
+static superblock* arena_superblock(arena_t *arena) {
+    if (!(arena->map_flags & MAP_FILE_BACKED)) {
+        return NULL;
     }
+    return (superblock*)arena->mmap_ptr;
+}
+
 
-    if(splitFit) { //block found is not a perfect fit
-        currBestFit->size_status = blockSizeNeed;
-        currBestFit->size_status += 1; //allocate
+/*
+ * Function for opening a heap kept in the file 'path'.
+ * If the file is empty or does not exist it is created with a new heap of
+ * 'sizeOfRegion' bytes and mapped at 'baseAddr', or wherever the kernel
+ * picks if baseAddr is NULL. An existing file is mapped back at the address
+ * recorded in it and sizeOfRegion and baseAddr are ignored. Reattaching
+ * fails if that address is taken in this process.
+ * Argument path: the file holding the heap
+ * Argument sizeOfRegion: size of a new heap
+ * Argument baseAddr: page aligned address for a new heap or NULL
+ * Returns the arena on success.
+ * Returns NULL on failure.
+ */
+arena_t* arena_open_file(const char *path, bsize_t sizeOfRegion, void *baseAddr) {
+    int offset = ((sizeof(superblock) + sizeof(arena_t) + ALIGNMENT - 1) / ALIGNMENT) * ALIGNMENT;
+    superblock header;
+    superblock *sb;
+    arena_t *arena;
+    struct stat st;
+    void *mmap_ptr;
+    bsize_t map_size;
+    int fd;
 
-        if(prevPBit && !(currBestFit->size_status & 2)) { //checks prevPBit variable and if the currBestFit already has a pbit
-            currBestFit->size_status += 2;
-        } 
+    fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (-1 == fd) {
+        fprintf(stderr, "Error:mem.c: Cannot open %s\n", path);
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
 
-        splitBlock = (blockHeader*)((char*)currBestFit + blockSizeNeed); //split the block
-        splitBlock->size_status = currBestFitSize - blockSizeNeed;
+    if (st.st_size == 0) { //new heap
+        if (sizeOfRegion <= 0 || sizeOfRegion > BSIZE_MAX - offset - getpagesize()) {
+            fprintf(stderr, "Error:mem.c: Requested block size is not positive\n");
+            close(fd);
+            return NULL;
+        }
+        map_size = round_to(sizeOfRegion + offset, getpagesize());
+        if (ftruncate(fd, map_size) != 0) {
+            fprintf(stderr, "Error:mem.c: Cannot size %s\n", path);
+            close(fd);
+            return NULL;
+        }
+    } else { //existing heap, the superblock says where it goes
+        if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || header.magic != CHEAP_FILE_MAGIC ||
+            header.version != CHEAP_FILE_VERSION || header.header_size != (int)sizeof(blockHeader) ||
+            header.arena_size != (int)sizeof(arena_t) || header.offset != offset || header.file_size != st.st_size) {
+            fprintf(stderr, "Error:mem.c: %s is not a heap of this build\n", path);
+            close(fd);
+            return NULL;
+        }
+        map_size = header.file_size;
+        baseAddr = header.base;
+    }
 
-        if(splitBlock->size_status != 1) {
-            splitBlock->size_status += 2; //set p bit of the split block
+    mmap_ptr = mmap(baseAddr, map_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | (baseAddr ? MAP_FIXED_NOREPLACE : 0), fd, 0);
+    if (MAP_FAILED == mmap_ptr || (baseAddr && mmap_ptr != baseAddr)) {
+        fprintf(stderr, "Error:mem.c: mmap cannot map %s at %p\n", path, baseAddr);
+        if (MAP_FAILED != mmap_ptr) {
+            munmap(mmap_ptr, map_size);
+        }
+        if (st.st_size == 0 && ftruncate(fd, 0) != 0) { //empty again, a later open makes a new heap
+            fprintf(stderr, "Error:mem.c: Cannot reset %s\n", path);
         }
-        
-        return ((void*)currBestFit) + sizeof(blockHeader); //return the address of the payload
-    } else { 
-        return NULL; //no block found, null is returned
+        close(fd);
+        return NULL;
     }
-} 
+    close(fd);
 
-/* 
- * Function for freeing up a previously allocated block.
- * Argument ptr: address of the block to be freed up.
- * Returns 0 on success.
- * Returns -1 on failure.
- * This function should:
- * - Return -1 if ptr is NULL.
- * - Return -1 if ptr is not a multiple of 8.
- * - Return -1 if ptr is outside of the heap space.
- * - Return -1 if ptr block is already freed.
- * - Update header(s) and footer as needed.
- */                    
-int bfree(void *ptr) {   
-    if(ptr == NULL) {  //checks if the pointer is null
-        return -1;
-    } 
+    sb = (superblock*)mmap_ptr;
+    arena = (arena_t*)(sb + 1);
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_init(&arena->lock, NULL); //a lock left in the file means nothing to this process
+#endif
+    if (st.st_size == 0) {
+        sb->version = CHEAP_FILE_VERSION;
+        sb->header_size = sizeof(blockHeader);
+        sb->arena_size = sizeof(arena_t);
+        sb->offset = offset;
+        sb->base = mmap_ptr;
+        sb->file_size = map_size;
+        sb->root = NULL;
+        arena->immediate_coalesce = CHEAP_IMMEDIATE_COALESCE;
+        arena->fit_policy = CHEAP_FIT_POLICY;
+#ifdef CHEAP_DEBUG
+        arena->check_interval = arena->check_countdown = CHEAP_CHECK_INTERVAL;
+#endif
+        arena->map_flags = MAP_FILE_BACKED;
+        arena->max_size = 0;
+        init_arena_region(arena, mmap_ptr, map_size, offset);
+        sb->magic = CHEAP_FILE_MAGIC; //written last, a half made file is not taken for a heap
+        return arena;
+    }
 
-    blockHeader *ptrBlock = (blockHeader*)((char*)ptr - sizeof(blockHeader)); //adjust for the header
-    if((unsigned int)ptr % 8 != 0) { //checks if the pointer is a multiple of 8
-        return -1;
-    } 
-    if(!(ptrBlock->size_status & 1)) { //block is already freed
-        return -1;
+    if (arena->heap_start != (blockHeader*)((char*)mmap_ptr + offset + ALIGNMENT - sizeof(blockHeader)) ||
+        arena->alloc_size != map_size - offset - ALIGNMENT || arena_check_heap(arena) != 0) {
+        fprintf(stderr, "Error:mem.c: heap in %s is damaged\n", path);
+        munmap(mmap_ptr, map_size);
+        return NULL;
     }
-    if(ptrBlock < heap_start || ptrBlock > (heap_start + alloc_size - 8)) { //checks if the ptr is inside the heap space
+    rebuild_free_lists(arena);
+    return arena;
+}
+
+/*
+ * Function for writing the heap of a file backed arena to its file.
+ * Everything allocated before the call survives a crash after it returns.
+ * Returns 0 on success.
+ * Returns -1 on failure or if the arena is not file backed.
+ */
+int arena_checkpoint(arena_t *arena) {
+    int result;
+
+    if (arena_superblock(arena) == NULL) {
         return -1;
     }
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#endif
+    result = msync(arena->mmap_ptr, arena->map_size, MS_SYNC);
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
+    return result == 0 ? 0 : -1;
+}
 
-    //actualy free the block
-    int ptrBlockSizeShifted = (ptrBlock->size_status >> 2) << 2;
-    ptrBlock->size_status -= 1; //set the a bit to 0
+/*
+ * Function for storing the entry point to the data of a file backed arena,
+ * usually a block allocated from it, so it can be found after reattaching.
+ * Returns 0 on success.
+ * Returns -1 if the arena is not file backed.
+ */
+int arena_set_root(arena_t *arena, void *root) {
+    superblock *sb = arena_superblock(arena);
 
-    blockHeader *nextBlock = (blockHeader*)((char*)ptrBlock + ptrBlockSizeShifted); //get the next block
-    
-    if(nextBlock->size_status != 1 && nextBlock->size_status & 2) { //check if the next block is the end and if the p bit is set
-        nextBlock->size_status -= 2; //set the p bit of the next block to 0
-    }   
-    
+    if (sb == NULL) {
+        return -1;
+    }
+    sb->root = root;
     return 0;
-} 
+}
 
 /*
- * Function for traversing heap block list and coalescing all adjacent 
- * free blocks.
- *
- * This function is used for delayed coalescing.
- * Updated header size_status and footer size_status as needed.
+ * Function for getting the root stored with arena_set_root.
+ * Returns NULL if there is none or the arena is not file backed.
  */
-int coalesce() {
-    blockHeader *currCoalBlock = heap_start; //start of the heap 
-    blockHeader *nextCoalBlock;
+void* arena_get_root(arena_t *arena) {
+    superblock *sb = arena_superblock(arena);
+    return sb != NULL ? sb->root : NULL;
+}
+                  
+/*
+ * Calls 'visit' for every block of 'arena' in address order with the size
+ * and status decoded from its header. disp_heap and arena_heap_usage both
+ * walk the heap through this, so their numbers always agree.
+ * In thread-safe mode the caller must hold the arena lock.
+ */
+typedef void (*blockVisitor)(blockHeader *block, bsize_t t_size, int is_used, int p_used, void *ctx);
 
-    int counter = 0; //used to keep track of the number of coalesced blocks 
-    int currCoalBlockSize;
-    int currCoalShifted; //size of block without a and p bit
-    int nextCoalShifted; //size of block without a and p bit
-    int nextCoalBlockSize;
+static void walk_heap(arena_t *arena, blockVisitor visit, void *ctx) {
+    blockHeader *current = arena->heap_start;
+    bsize_t t_size;
+    int is_used;
+    int p_used;
 
-    while(currCoalBlock->size_status != 1) {
-        currCoalBlockSize = currCoalBlock->size_status; //size of the current block including a and p bit
-        currCoalShifted = (currCoalBlockSize >> 2) << 2; //shift the bits to get rid of a and p bit
+    while (current->size_status != 1) {
+        t_size = current->size_status;
+        is_used = t_size & 1;        // LSB = 1 => used block
+        p_used = (t_size & 2) >> 1;  // second bit = 1 => previous block used
+        t_size = (t_size >> 2) << 2;
 
-        if(((blockHeader*)((char*)currCoalBlock + currCoalShifted))->size_status == 1) { //if the next block is the end of heap, break loop
-            break;
-        }
+        visit(current, t_size, is_used, p_used, ctx);
+    
+        current = (blockHeader*)((char*)current + t_size);
+    }
+}
 
-        nextCoalBlock = (blockHeader*)((char*)currCoalBlock + currCoalShifted); //next block 
-        nextCoalBlockSize = nextCoalBlock->size_status;
-        nextCoalShifted = (nextCoalBlockSize >> 2) << 2;
+static void usage_block(blockHeader *block, bsize_t t_size, int is_used, int p_used, void *ctx) {
+    heapUsage *usage = (heapUsage*)ctx;
+    (void)block;
+    (void)p_used;
 
-        //current block is allocated
-        if(currCoalBlockSize & 1){
-            currCoalBlock = nextCoalBlock; //set the current block to the next block
-            continue;
+    if (is_used) {
+        usage->used_size += t_size;
+        usage->used_blocks++;
+        usage->top_free = 0;
+    } else {
+        usage->free_size += t_size;
+        usage->free_blocks++;
+        usage->top_free = t_size;
+        if (t_size > usage->largest_free) {
+            usage->largest_free = t_size;
         }
+    }
+}
 
-        //next block is allocated
-        if(nextCoalBlockSize & 1){
-            currCoalBlock = (blockHeader*)((char*)nextCoalBlock + nextCoalShifted); //get the block after the next of current block
-            continue;
-        }
+/*
+ * Function for getting the used and free totals, the number of blocks and
+ * the largest free block of 'arena'.
+ * External fragmentation is 1 - largest_free / free_size.
+ */
+void arena_heap_usage(arena_t *arena, heapUsage *usage) {
+    memset(usage, 0, sizeof(heapUsage));
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#endif
+    walk_heap(arena, usage_block, usage);
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
+}
 
-        //if both currBlock and nextBlock are free, then coalesce
-        if( (!(currCoalBlockSize & 1)) && (!(nextCoalBlockSize & 1)) ) {
-            currCoalBlock->size_status += nextCoalShifted; //current block is now current + next block, coalesced 
-            currCoalShifted = ((currCoalBlock->size_status) >> 2) << 2;
-            nextCoalBlock->size_status = 0; //set the size of the next block to 0
+/*
+ * Function for getting the usage of the heap set up by init_heap, see
+ * arena_heap_usage.
+ */
+void heap_usage(heapUsage *usage) {
+    arena_heap_usage(&main_arena, usage);
+}
 
-            currCoalBlock = (blockHeader*)((char*)currCoalBlock + currCoalShifted);
-            counter++; //blocks have been coalesced, we can now return 1 when while loop exited
-            continue;
+/*
+ * Walks the block list of 'arena' and returns the first problem found, see
+ * arena_check_heap, or NULL if there is none. Two free blocks next to each
+ * other only count as a problem when 'allowAdjacentFree' is 0.
+ * '*where' and '*counter' are set to the block the walk stopped at and its number.
+ * The caller must hold the arena lock in thread-safe mode.
+ */
+static const char* check_blocks(arena_t *arena, int allowAdjacentFree, blockHeader **where, int *counter) {
+    blockHeader *current = arena->heap_start;
+    char *heapEnd = (char*)arena->end_mark;
+    bsize_t t_size;
+    int prevUsed = 1; //the first block has its p-bit set
+    const char *problem = NULL;
+
+    *counter = 1;
+    if (arena->end_mark != (blockHeader*)((char*)arena->heap_start + arena->alloc_size) ||
+        arena->end_mark->size_status != 1) {
+        problem = "end mark is not at heap_start + alloc_size";
+    }
+    while (problem == NULL && current->size_status != 1) {
+        t_size = block_size(current);
+        if (t_size < MIN_BLOCK_SIZE || t_size % ALIGNMENT != 0 || t_size > heapEnd - (char*)current) {
+            problem = "bad block size";
+        } else if (((current->size_status & 2) != 0) != prevUsed) {
+            problem = "p-bit does not match the previous block";
+        } else if (!(current->size_status & 1) &&
+                   ((blockHeader*)((char*)current + t_size - sizeof(blockHeader)))->size_status != t_size) {
+            problem = "free block footer does not match its header";
+        } else if (!(current->size_status & 1) && !prevUsed && !allowAdjacentFree) {
+            problem = "two free blocks next to each other";
+#ifdef CHEAP_DEBUG
+        } else if ((current->size_status & 1) && canary_slot(current)->size_status != canary_value(current)) {
+            problem = "canary overwritten";
+#endif
+        } else {
+            prevUsed = current->size_status & 1;
+            current = (blockHeader*)((char*)current + t_size);
+            (*counter)++;
         }
     }
-
-    if(counter < 1){ //if no blocks were coalesced 
-        return 0;
-    } else { //else blocks were coalesced
-        return 1;
+    if (problem == NULL && current != arena->end_mark) {
+        problem = "block list does not end at the end mark";
     }
+    *where = current;
+    return problem;
 }
 
- 
-/* 
- * Function used to initialize the memory allocator.
- * Intended to be called ONLY once by a program.
- * Argument sizeOfRegion: the size of the heap space to be allocated.
- * Returns 0 on success.
- * Returns -1 on failure.
- */                    
-int init_heap(int sizeOfRegion) {    
- 
-    static int allocated_once = 0; //prevent multiple myInit calls
- 
-    int pagesize;   // page size
-    int padsize;    // size of padding when heap size not a multiple of page size
-    void* mmap_ptr; // pointer to memory mapped area
-    int fd;
+/*
+ * Function for checking that the block list of 'arena' is consistent:
+ * - every block has a size that is a multiple of ALIGNMENT, at least
+ *   MIN_BLOCK_SIZE, and ends inside the heap
+ * - the p-bit of every block matches the a-bit of the block before it
+ * - every free block has a footer holding its size
+ * - with immediate coalescing no two free blocks are next to each other
+ * - in debug mode every allocated block ends with its canary
+ * - the walk ends at the end mark after exactly alloc_size bytes
+ * Returns 0 if the heap is consistent.
+ * Returns -1 and prints the first problem found otherwise.
+ */
+int arena_check_heap(arena_t *arena) {
+    blockHeader *current;
+    int counter;
+    const char *problem;
 
-    blockHeader* end_mark;
-  
-    if (0 != allocated_once) {
-        fprintf(stderr, 
-        "Error:mem.c: InitHeap has allocated space during a previous call\n");
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#endif
+    problem = check_blocks(arena, !arena->immediate_coalesce, &current, &counter);
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
+
+    if (problem != NULL) {
+        fprintf(stderr, "Error:mem.c: block %d at 0x%08lx: %s\n", counter, (unsigned long int)current, problem);
         return -1;
     }
+    return 0;
+}
 
-    if (sizeOfRegion <= 0) {
-        fprintf(stderr, "Error:mem.c: Requested block size is not positive\n");
-        return -1;
+/*
+ * Function for checking the heap set up by init_heap, see arena_check_heap.
+ */
+int check_heap() {
+    return arena_check_heap(&main_arena);
+}
+
+/*
+ * Copies the counters of 'arena' into 'stats' and fills in the sizes.
+ * The largest free block is in the highest non-empty size class, so only
+ * that list is searched. The caller must hold the arena lock.
+ */
+static void fill_stats(arena_t *arena, heapStats *stats) {
+    blockHeader *block;
+    int topClass;
+
+    *stats = arena->stats;
+    stats->heap_size = arena->alloc_size;
+    stats->bytes_in_use = stats->heap_size - stats->free_bytes;
+    stats->largest_free = 0;
+    if(arena->free_list_map != 0) {
+        topClass = 63 - __builtin_clzll(arena->free_list_map);
+        for(block = arena->free_lists[topClass]; block != NULL; block = free_links(block)->next) {
+            if(block_size(block) > stats->largest_free) {
+                stats->largest_free = block_size(block);
+            }
+        }
     }
+}
 
-    // Get the pagesize
-    pagesize = getpagesize();
+/*
+ * Function for reading the allocation counters of 'arena' together with
+ * its current size, bytes in use, free blocks and largest free block.
+ * Unlike arena_heap_usage this does not walk the heap, so it is cheap
+ * enough to scrape from a running program.
+ */
+void arena_heap_stats(arena_t *arena, heapStats *stats) {
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#endif
+    fill_stats(arena, stats);
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
+}
 
-    // Calculate padsize as the padding required to round up sizeOfRegion 
-    // to a multiple of pagesize
-    padsize = sizeOfRegion % pagesize;
-    padsize = (pagesize - padsize) % pagesize;
+/*
+ * Function for reading the counters of the heap set up by init_heap, see
+ * arena_heap_stats.
+ */
+void heap_stats(heapStats *stats) {
+    arena_heap_stats(&main_arena, stats);
+}
 
-    alloc_size = sizeOfRegion + padsize;
+typedef struct dumpState {
+    FILE *fp;
+    int format;
+    int counter;
+    blockHeader *heap_start;
+} dumpState;
 
-    // Using mmap to allocate memory
-    fd = open("/dev/zero", O_RDWR);
-    if (-1 == fd) {
-        fprintf(stderr, "Error:mem.c: Cannot open /dev/zero\n");
-        return -1;
+static void dump_block(blockHeader *current, bsize_t t_size, int is_used, int p_used, void *ctx) {
+    dumpState *state = (dumpState*)ctx;
+    long offset = (char*)current - (char*)state->heap_start;
+
+    if (state->format == CHEAP_DUMP_JSON) {
+        fprintf(state->fp, "%s\n    {\"no\": %d, \"status\": \"%s\", \"prev\": \"%s\", "
+                "\"begin\": \"0x%08lx\", \"offset\": %ld, \"size\": %ld}",
+                state->counter == 1 ? "" : ",", state->counter,
+                is_used ? "alloc" : "free", p_used ? "alloc" : "free",
+                (unsigned long int)current, offset, (long)t_size);
+    } else {
+        fprintf(state->fp, "%d,%s,%s,0x%08lx,%ld,%ld\n", state->counter,
+                is_used ? "alloc" : "free", p_used ? "alloc" : "free",
+                (unsigned long int)current, offset, (long)t_size);
     }
-    mmap_ptr = mmap(NULL, alloc_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
-    if (MAP_FAILED == mmap_ptr) {
-        fprintf(stderr, "Error:mem.c: mmap cannot allocate space\n");
-        allocated_once = 0;
+    state->counter++;
+}
+
+/*
+ * Function for writing the block list of 'arena' to 'fp' in a format that
+ * is easy to load into other tools instead of parsing disp_heap output.
+ * CHEAP_DUMP_CSV writes one line per block after a header line:
+ *   no,status,prev,begin,offset,size
+ * CHEAP_DUMP_JSON writes one object with the heap_stats counters under
+ * "stats" and the blocks, with the same fields, under "blocks".
+ * offset is the distance of the block header from heap_start.
+ * Returns 0 on success.
+ * Returns -1 if the format is unknown.
+ */
+int arena_dump_heap(arena_t *arena, FILE *fp, int format) {
+    dumpState state = {fp, format, 1, arena->heap_start};
+    heapStats stats;
+
+    if (format != CHEAP_DUMP_CSV && format != CHEAP_DUMP_JSON) {
         return -1;
     }
-  
-    allocated_once = 1;
 
-    // for double word alignment and end mark
-    alloc_size -= 8;
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#endif
+    if (format == CHEAP_DUMP_JSON) {
+        fill_stats(arena, &stats);
+        fprintf(fp, "{\n  \"stats\": {\"allocs\": %llu, \"frees\": %llu, \"reallocs\": %llu, "
+                "\"failed_allocs\": %llu, \"coalesced\": %llu,\n"
+                "    \"heap_size\": %ld, \"bytes_in_use\": %ld, \"free_bytes\": %ld, "
+                "\"free_blocks\": %ld, \"largest_free\": %ld,\n    \"size_hist\": [",
+                stats.allocs, stats.frees, stats.reallocs, stats.failed_allocs, stats.coalesced,
+                stats.heap_size, stats.bytes_in_use, stats.free_bytes, stats.free_blocks,
+                (long)stats.largest_free);
+        for (int i = 0; i < CHEAP_SIZE_BUCKETS; i++) {
+            fprintf(fp, "%s%llu", i == 0 ? "" : ", ", stats.size_hist[i]);
+        }
+        fprintf(fp, "]},\n  \"blocks\": [");
+    } else {
+        fprintf(fp, "no,status,prev,begin,offset,size\n");
+    }
 
-    // Initially there is only one big free block in the heap.
-    // Skip first 4 bytes for double word alignment requirement.
-    heap_start = (blockHeader*) mmap_ptr + 1;
+    walk_heap(arena, dump_block, &state);
 
-    // Set the end mark
-    end_mark = (blockHeader*)((void*)heap_start + alloc_size);
-    end_mark->size_status = 1;
+    if (format == CHEAP_DUMP_JSON) {
+        fprintf(fp, "\n  ]\n}\n");
+    }
+    fflush(fp);
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
+    return 0;
+}
 
-    // Set size in header
-    heap_start->size_status = alloc_size;
+/*
+ * Function for writing the block list of the heap set up by init_heap to
+ * 'fp', see arena_dump_heap.
+ */
+int dump_heap(FILE *fp, int format) {
+    return arena_dump_heap(&main_arena, fp, format);
+}
 
-    // Set p-bit as allocated in header
-    // note a-bit left at 0 for free
-    heap_start->size_status += 2;
+typedef struct dispState {
+    int counter;
+    long used_size;
+    long free_size;
+} dispState;
 
-    // Set the footer
-    blockHeader *footer = (blockHeader*) ((void*)heap_start + alloc_size - 4);
-    footer->size_status = alloc_size;
-  
-    return 0;
-} 
+static void disp_block(blockHeader *current, bsize_t t_size, int is_used, int p_used, void *ctx) {
+    dispState *state = (dispState*)ctx;
+    char *t_begin = (char*)current;
+    char *t_end = t_begin + t_size - 1;
+
+    if (is_used) 
+        state->used_size += t_size;
+    else 
+        state->free_size += t_size;
+
+    fprintf(stdout, "%d\t%s\t%s\t0x%08lx\t0x%08lx\t%4li\n", state->counter, 
+    is_used ? "alloc" : "FREE ", p_used ? "alloc" : "FREE ",
+    (unsigned long int)t_begin, (unsigned long int)t_end, (long)t_size);
+
+    state->counter = state->counter + 1;
+}
                   
 /* 
  * Function to be used for DEBUGGING to help you visualize your heap structure.
@@ -340,74 +2864,44 @@ int init_heap(int sizeOfRegion) {
  * t_Begin  : address of the first byte in the block (where the header starts) 
  * t_End    : address of the last byte in the block 
  * t_Size   : size of the block as stored in the block header
+ * of every block in 'arena'.
  */                     
-void disp_heap() {     
+void arena_disp_heap(arena_t *arena) {     
  
-    int counter;
-    char status[6];
-    char p_status[6];
-    char *t_begin = NULL;
-    char *t_end   = NULL;
-    int t_size;
-
-    blockHeader *current = heap_start;
-    counter = 1;
-
-    int used_size = 0;
-    int free_size = 0;
-    int is_used   = -1;
+    dispState state = {1, 0, 0};
 
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_lock(&arena->lock);
+#endif
     fprintf(stdout, 
 	"*********************************** Block List **********************************\n");
     fprintf(stdout, "No.\tStatus\tPrev\tt_Begin\t\tt_End\t\tt_Size\n");
     fprintf(stdout, 
 	"---------------------------------------------------------------------------------\n");
   
-    while (current->size_status != 1) {
-        t_begin = (char*)current;
-        t_size = current->size_status;
-    
-        if (t_size & 1) {
-            // LSB = 1 => used block
-            strcpy(status, "alloc");
-            is_used = 1;
-            t_size = t_size - 1;
-        } else {
-            strcpy(status, "FREE ");
-            is_used = 0;
-        }
-
-        if (t_size & 2) {
-            strcpy(p_status, "alloc");
-            t_size = t_size - 2;
-        } else {
-            strcpy(p_status, "FREE ");
-        }
-
-        if (is_used) 
-            used_size += t_size;
-        else 
-            free_size += t_size;
-
-        t_end = t_begin + t_size - 1;
-    
-        fprintf(stdout, "%d\t%s\t%s\t0x%08lx\t0x%08lx\t%4i\n", counter, status, 
-        p_status, (unsigned long int)t_begin, (unsigned long int)t_end, t_size);
-    
-        current = (blockHeader*)((char*)current + t_size);
-        counter = counter + 1;
-    }
+    walk_heap(arena, disp_block, &state);
 
     fprintf(stdout, 
 	"---------------------------------------------------------------------------------\n");
     fprintf(stdout, 
 	"*********************************************************************************\n");
-    fprintf(stdout, "Total used size = %4d\n", used_size);
-    fprintf(stdout, "Total free size = %4d\n", free_size);
-    fprintf(stdout, "Total size      = %4d\n", used_size + free_size);
+    fprintf(stdout, "Total used size = %4ld\n", state.used_size);
+    fprintf(stdout, "Total free size = %4ld\n", state.free_size);
+    fprintf(stdout, "Total size      = %4ld\n", state.used_size + state.free_size);
     fprintf(stdout, 
 	"*********************************************************************************\n");
     fflush(stdout);
+#ifdef CHEAP_THREAD_SAFE
+    pthread_mutex_unlock(&arena->lock);
+#endif
 
     return;  
 } 
+
+/*
+ * Function to be used for DEBUGGING to help you visualize the heap set up
+ * by init_heap.
+ */
+void disp_heap() {
+    arena_disp_heap(&main_arena);
+}
@@ -0,0 +1,181 @@
+/*
+ * CHeap.h:
+ * Interface of the CHeap allocator in CHeap.c.
+ *
+ * The functions without an arena argument work on the single heap set up
+ * by init_heap. The arena_ functions work on independent heaps made by
+ * arena_create.
+ */
+
+#ifndef CHEAP_H
+#define CHEAP_H
+
+#include <stdio.h>
+
+typedef struct arena arena_t;
+
+/*
+ * Type of block and request sizes. By default blocks have a 4 byte header
+ * and 8 byte aligned payloads, which keeps a heap below 2 GiB. Build with
+ * -DCHEAP_WIDE_HEADER for 8 byte headers, 16 byte aligned payloads and
+ * 64-bit sizes. The a and p bits are encoded the same way in both.
+ * Everything using CHeap must be built with the same setting.
+ */
+#ifdef CHEAP_WIDE_HEADER
+typedef long bsize_t;
+#else
+typedef int bsize_t;
+#endif
+
+/*
+ * Occupancy of one slab as reported by arena_slab_stats.
+ */
+typedef struct slabStats {
+    void *slab;           //address of the slab page
+    int obj_size;
+    int capacity;
+    int in_use;
+} slabStats;
+
+/*
+ * Totals from one walk over the block list, the same walk disp_heap does.
+ * Sizes include headers, footers and padding.
+ */
+typedef struct heapUsage {
+    long used_size;       //bytes in allocated blocks
+    long free_size;       //bytes in free blocks
+    long used_blocks;
+    long free_blocks;
+    bsize_t largest_free; //size of the largest free block
+    bsize_t top_free;     //size of the free block before the end mark, 0 if none
+} heapUsage;
+
+/*
+ * Counters the allocator keeps up to date as it runs, read with heap_stats.
+ * In thread-safe mode blocks served by a thread cache are counted when they
+ * move between the cache and the heap, not on every balloc and bfree.
+ */
+#ifdef CHEAP_WIDE_HEADER
+#define CHEAP_SIZE_BUCKETS 60
+#else
+#define CHEAP_SIZE_BUCKETS 28
+#endif
+
+typedef struct heapStats {
+    unsigned long long allocs;        //blocks taken from the free lists
+    unsigned long long frees;         //blocks put back on the free lists
+    unsigned long long reallocs;      //blocks resized by brealloc
+    unsigned long long failed_allocs; //allocations that found no space
+    unsigned long long coalesced;     //free blocks merged into a neighbour
+    long heap_size;                   //bytes from heap_start up to the end mark
+    long bytes_in_use;                //bytes in allocated blocks, headers included
+    long free_bytes;                  //bytes in free blocks
+    long free_blocks;
+    bsize_t largest_free;
+    unsigned long long size_hist[CHEAP_SIZE_BUCKETS]; //allocations by block size, bucket i counts [2^(i+4), 2^(i+5))
+} heapStats;
+
+/*
+ * Backing of the heap region for init_heap_opts and arena_create_opts.
+ * By default a heap maps /dev/zero and takes a page fault on the first
+ * touch of every 4 KiB page.
+ */
+#define CHEAP_MAP_ANON     0x01  //anonymous memory instead of /dev/zero
+#define CHEAP_MAP_HUGETLB  0x02  //explicit huge pages from the hugetlbfs pool (MAP_HUGETLB)
+#define CHEAP_MAP_THP      0x04  //transparent huge pages (madvise MADV_HUGEPAGE)
+#define CHEAP_MAP_POPULATE 0x08  //fault every page in when it is mapped (MAP_POPULATE)
+#define CHEAP_MAP_LOCK     0x10  //keep the pages in memory (mlock)
+
+/*
+ * Placement policies for set_fit_policy, the free lists are segregated by
+ * size class in all of them.
+ */
+#define CHEAP_FIT_BEST  0  //smallest block that fits, the default
+#define CHEAP_FIT_FIRST 1  //lowest addressed block that fits, keeps the heap compact
+#define CHEAP_FIT_NEXT  2  //first block that fits after where the last search stopped
+#define CHEAP_FIT_GOOD  3  //best of the first few blocks of a size class
+
+//block list formats for dump_heap
+#define CHEAP_DUMP_CSV 0
+#define CHEAP_DUMP_JSON 1
+
+//heap set up by init_heap
+int init_heap(bsize_t sizeOfRegion);
+int init_heap_growable(bsize_t sizeOfRegion, bsize_t maxSize);
+int init_heap_opts(bsize_t sizeOfRegion, bsize_t maxSize, int flags);
+void* balloc(bsize_t size);
+int bfree(void *ptr);
+void* brealloc(void *ptr, bsize_t size);
+void* balign(int alignment, bsize_t size);
+int bmemalign(void **memptr, int alignment, bsize_t size);
+int coalesce();
+void set_coalesce_mode(int immediate);
+int set_fit_policy(int policy);
+bsize_t trim_heap(bsize_t pad);
+void heap_usage(heapUsage *usage);
+void heap_stats(heapStats *stats);
+int check_heap();
+int dump_heap(FILE *fp, int format);
+void disp_heap();
+
+void* salloc(int size);
+int sfree(void *ptr);
+void disp_slabs();
+
+int region_begin();
+void* ralloc(bsize_t size);
+void* region_mark();
+int region_release(void *mark);
+int region_end();
+
+#ifdef CHEAP_THREAD_SAFE
+void flush_thread_cache();
+#endif
+
+/*
+ * Build with -DCHEAP_DEBUG for canaries after every payload, poisoned
+ * freed memory and a full check_heap every CHEAP_CHECK_INTERVAL heap
+ * operations, see CHeap.c. Corruption aborts the program.
+ */
+#ifdef CHEAP_DEBUG
+void set_check_interval(int interval);
+#endif
+
+//independent arenas
+arena_t* arena_create(bsize_t sizeOfRegion);
+arena_t* arena_create_growable(bsize_t sizeOfRegion, bsize_t maxSize);
+arena_t* arena_create_opts(bsize_t sizeOfRegion, bsize_t maxSize, int flags);
+int arena_destroy(arena_t *arena);
+arena_t* arena_open_file(const char *path, bsize_t sizeOfRegion, void *baseAddr);
+int arena_checkpoint(arena_t *arena);
+int arena_set_root(arena_t *arena, void *root);
+void* arena_get_root(arena_t *arena);
+void* arena_balloc(arena_t *arena, bsize_t size);
+int arena_bfree(arena_t *arena, void *ptr);
+void* arena_brealloc(arena_t *arena, void *ptr, bsize_t size);
+void* arena_balign(arena_t *arena, int alignment, bsize_t size);
+int arena_coalesce(arena_t *arena);
+void arena_set_coalesce_mode(arena_t *arena, int immediate);
+int arena_set_fit_policy(arena_t *arena, int policy);
+bsize_t arena_trim(arena_t *arena, bsize_t pad);
+void arena_heap_usage(arena_t *arena, heapUsage *usage);
+void arena_heap_stats(arena_t *arena, heapStats *stats);
+int arena_check_heap(arena_t *arena);
+#ifdef CHEAP_DEBUG
+void arena_set_check_interval(arena_t *arena, int interval);
+#endif
+int arena_dump_heap(arena_t *arena, FILE *fp, int format);
+void arena_disp_heap(arena_t *arena);
+
+void* arena_salloc(arena_t *arena, int size);
+int arena_sfree(arena_t *arena, void *ptr);
+int arena_slab_stats(arena_t *arena, slabStats *stats, int maxSlabs);
+void arena_disp_slabs(arena_t *arena);
+
+int arena_region_begin(arena_t *arena);
+void* arena_ralloc(arena_t *arena, bsize_t size);
+void* arena_region_mark(arena_t *arena);
+int arena_region_release(arena_t *arena, void *mark);
+int arena_region_end(arena_t *arena);
+
+#endif
@@ -0,0 +1,787 @@
+/*
+ * CHeapBench.c:
+ * A benchmark driver for the CHeap allocator. Replays an allocation trace,
+ * read from a file or made by one of the synthetic generators, against
+ * CHeap and reports throughput, latency percentiles per operation, peak
+ * heap utilization and external fragmentation.
+ *
+ * With -T every page of each new payload is written right after balloc, so
+ * the "touch" latencies show what first touch page faults cost. Together
+ * with the page fault and dTLB miss counts this compares heap backings
+ * (-B), e.g. for a randomized workload:
+ *   cheap_bench -g random -T -H 268435456
+ *   cheap_bench -g random -T -H 268435456 -B anon,thp
+ *   cheap_bench -g random -T -H 268435456 -B anon,thp,populate
+ * dTLB misses are read with perf_event_open and show up as n/a where the
+ * kernel does not allow it (see /proc/sys/kernel/perf_event_paranoid).
+ *
+ * -P picks the placement policy of balloc. -P all replays the same trace
+ * once per policy, each in a fresh process and heap, and ends with a table
+ * comparing throughput and fragmentation:
+ *   cheap_bench -g prodcons -P all
+ *
+ * Build:
+ *   gcc -O2 -o cheap_bench CHeapBench.c CHeap.c
+ *
+ * Trace format, one operation per line, lines starting with '#' are skipped:
+ *   a <id> <size>   allocate 'size' bytes and call the block 'id'
+ *   f <id>          free block 'id'
+ *   r <id> <size>   resize block 'id' to 'size' bytes, size 0 frees it
+ */
+
+#include <getopt.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/perf_event.h>
+#include "CHeap.h"
+
+//Type trace_op_t: one operation of a trace.
+typedef struct trace_op {
+    char type;  //'a', 'f' or 'r'
+    int id;
+    int size;
+} trace_op_t;
+
+//Type trace_t: a whole trace, ids run from 0 to num_ids - 1.
+typedef struct trace {
+    trace_op_t *ops;
+    int num_ops;
+    int cap_ops;
+    int num_ids;
+} trace_t;
+
+//Operations timed by the replay, indexes into the latency arrays.
+enum { OP_ALLOC, OP_FREE, OP_REALLOC, OP_COALESCE, OP_TOUCH, NUM_OP_TYPES };
+const char *op_names[NUM_OP_TYPES] = {"balloc", "bfree", "brealloc", "coalesce", "touch"};
+
+//Type latency_t: latencies in nanoseconds of every operation of one type.
+typedef struct latency {
+    long long *ns;
+    int count;
+    int cap;
+} latency_t;
+
+//Type replay_result_t: everything measured by one replay.
+typedef struct replay_result {
+    latency_t lat[NUM_OP_TYPES];
+    double seconds;          //time spent in allocator calls
+    long long ops;
+    long long failed;        //allocations that returned NULL
+    long long peak_live;     //largest sum of live payload sizes
+    long heap_size;          //heap size at the end of the run
+    long heap_top;           //highest end of the last allocated block
+    double frag_sum;         //external fragmentation samples
+    double frag_max;
+    double frag_at_peak;     //external fragmentation when the live payload peaked
+    int frag_samples;
+    double init_seconds;     //time spent setting up the heap
+    long page_faults;        //minor and major page faults during the replay
+    long long tlb_misses;    //dTLB load misses during the replay, -1 if not available
+} replay_result_t;
+
+//Type policy_summary_t: the numbers -P all compares across placement policies.
+typedef struct policy_summary {
+    double mops;             //allocator throughput in Mops/s
+    long long alloc_p99;     //balloc p99 latency in ns
+    long long failed;
+    double util_top;         //peak live payload / heap top
+    double frag_mean;
+    double frag_at_peak;
+} policy_summary_t;
+
+//Placement policies by CHEAP_FIT_ value, for -P.
+#define NUM_POLICIES 4
+const char *policy_names[NUM_POLICIES] = {"best", "first", "next", "good"};
+
+//Benchmark settings set by command line args.
+long heap_size = 64 << 20; //initial heap size
+long heap_max = 0;         //growable heap limit, 0 for a fixed heap
+int immediate = 0;         //immediate coalescing in bfree
+int coalesce_every = 0;    //call coalesce() every n ops, 0 only on failed allocations
+int sample_every = 1000;   //sample fragmentation every n ops
+int touch = 0;             //write every page of new payloads
+int map_flags = 0;         //CHEAP_MAP_ backing of the heap
+int fit_policy = -1;       //CHEAP_FIT_ placement policy, -1 keeps the default
+int min_size = 8;          //smallest generated request
+int max_size = 512;        //largest generated request
+int live_target = 10000;   //blocks kept live by the generators
+
+
+/*
+ * add_op:
+ * Appends one operation to the trace, growing it as needed.
+ */
+void add_op(trace_t *trace, char type, int id, int size) {
+    if (trace->num_ops == trace->cap_ops) {
+        trace->cap_ops = trace->cap_ops ? trace->cap_ops * 2 : 4096;
+        trace->ops = realloc(trace->ops, sizeof(trace_op_t) * trace->cap_ops);
+        if (trace->ops == NULL) {
+            exit(1);
+        }
+    }
+    trace->ops[trace->num_ops].type = type;
+    trace->ops[trace->num_ops].id = id;
+    trace->ops[trace->num_ops].size = size;
+    trace->num_ops++;
+    if (id >= trace->num_ids) {
+        trace->num_ids = id + 1;
+    }
+}
+
+
+/*
+ * read_trace:
+ * Reads a trace file in the format described at the top of this file.
+ */
+void read_trace(trace_t *trace, char *trace_fn) {
+    char buf[256];
+    char type;
+    int id;
+    int size;
+    FILE *trace_fp = fopen(trace_fn, "r");
+
+    if (!trace_fp) {
+        fprintf(stderr, "%s: %s\n", trace_fn, strerror(errno));
+        exit(1);
+    }
+    while (fgets(buf, sizeof(buf), trace_fp) != NULL) {
+        if (buf[0] == '#' || buf[0] == '\n') {
+            continue;
+        }
+        size = 0;
+        if (sscanf(buf, " %c %d %d", &type, &id, &size) < 2 || id < 0 ||
+            (type != 'a' && type != 'f' && type != 'r')) {
+            fprintf(stderr, "%s: bad line: %s", trace_fn, buf);
+            exit(1);
+        }
+        add_op(trace, type, id, size);
+    }
+    fclose(trace_fp);
+}
+
+
+/*
+ * write_trace:
+ * Writes a trace so a generated workload can be replayed later.
+ */
+void write_trace(trace_t *trace, char *trace_fn) {
+    FILE *trace_fp = fopen(trace_fn, "w");
+
+    if (!trace_fp) {
+        fprintf(stderr, "%s: %s\n", trace_fn, strerror(errno));
+        exit(1);
+    }
+    for (int i = 0; i < trace->num_ops; i++) {
+        if (trace->ops[i].type == 'f') {
+            fprintf(trace_fp, "f %d\n", trace->ops[i].id);
+        } else {
+            fprintf(trace_fp, "%c %d %d\n", trace->ops[i].type, trace->ops[i].id, trace->ops[i].size);
+        }
+    }
+    fclose(trace_fp);
+}
+
+
+/*
+ * random_size:
+ * Returns a request size between min_size and max_size, small sizes are
+ * more likely like in most real workloads.
+ */
+int random_size() {
+    int range = max_size - min_size + 1;
+    int a = rand() % range;
+    int b = rand() % range;
+    return min_size + (a < b ? a : b);
+}
+
+
+/*
+ * generate_trace:
+ * Makes a synthetic trace of about 'num_ops' operations.
+ *   lifo     : blocks are freed in reverse order of allocation (stack)
+ *   fifo     : blocks are freed in order of allocation (queue)
+ *   random   : random blocks are freed or resized
+ *   prodcons : a producer allocates bursts of messages that a consumer
+ *              frees in arrival order some time later
+ * Every block still live at the end is freed.
+ */
+void generate_trace(trace_t *trace, char *pattern, int num_ops) {
+    int *live = malloc(sizeof(int) * (live_target + 1));  //ids of live blocks
+    int num_live = 0;
+    int head = 0;  //oldest live block for the queue patterns
+    int next_id = 0;
+    int burst;
+    int k;
+
+    if (live == NULL) {
+        exit(1);
+    }
+
+    if (strcmp(pattern, "lifo") == 0) {
+        while (trace->num_ops < num_ops) {
+            if (num_live == 0 || (num_live < live_target && rand() % 2)) {
+                add_op(trace, 'a', next_id, random_size());
+                live[num_live++] = next_id++;
+            } else {
+                add_op(trace, 'f', live[--num_live], 0);
+            }
+        }
+    } else if (strcmp(pattern, "fifo") == 0 || strcmp(pattern, "prodcons") == 0) {
+        //live is used as a ring buffer of live_target + 1 entries
+        int prodcons = strcmp(pattern, "prodcons") == 0;
+        while (trace->num_ops < num_ops) {
+            burst = prodcons ? 1 + rand() % 64 : 1;
+            for (k = 0; k < burst && num_live < live_target; k++) {
+                add_op(trace, 'a', next_id, prodcons && rand() % 8 == 0 ? max_size * 4 : random_size());
+                live[(head + num_live) % (live_target + 1)] = next_id++;
+                num_live++;
+            }
+            burst = prodcons ? 1 + rand() % 64 : (num_live == live_target);
+            for (k = 0; k < burst && num_live > 0; k++) {
+                add_op(trace, 'f', live[head], 0);
+                head = (head + 1) % (live_target + 1);
+                num_live--;
+            }
+        }
+    } else if (strcmp(pattern, "random") == 0) {
+        while (trace->num_ops < num_ops) {
+            k = rand() % 10;
+            if (num_live == 0 || (num_live < live_target && k < 5)) {
+                add_op(trace, 'a', next_id, random_size());
+                live[num_live++] = next_id++;
+            } else if (k < 9) {
+                k = rand() % num_live;
+                add_op(trace, 'f', live[k], 0);
+                live[k] = live[--num_live];
+            } else {
+                add_op(trace, 'r', live[rand() % num_live], random_size());
+            }
+        }
+    } else {
+        fprintf(stderr, "Unknown pattern %s\n", pattern);
+        exit(1);
+    }
+
+    //free whatever is still live, in queue order for the queue patterns
+    for (k = 0; k < num_live; k++) {
+        if (strcmp(pattern, "fifo") == 0 || strcmp(pattern, "prodcons") == 0) {
+            add_op(trace, 'f', live[(head + k) % (live_target + 1)], 0);
+        } else {
+            add_op(trace, 'f', live[k], 0);
+        }
+    }
+    free(live);
+}
+
+
+/*
+ * now_ns:
+ * Returns a monotonic timestamp in nanoseconds.
+ */
+long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+/*
+ * record:
+ * Adds one latency sample for an operation type.
+ */
+void record(latency_t *lat, long long ns) {
+    if (lat->count == lat->cap) {
+        lat->cap = lat->cap ? lat->cap * 2 : 4096;
+        lat->ns = realloc(lat->ns, sizeof(long long) * lat->cap);
+        if (lat->ns == NULL) {
+            exit(1);
+        }
+    }
+    lat->ns[lat->count++] = ns;
+}
+
+
+/*
+ * sample_fragmentation:
+ * Walks the heap and records its external fragmentation,
+ * 1 - largest free block / total free bytes.
+ */
+double sample_fragmentation(replay_result_t *result) {
+    heapUsage usage;
+    double frag = 0;
+
+    heap_usage(&usage);
+    if (usage.free_size > 0) {
+        frag = 1.0 - (double)usage.largest_free / usage.free_size;
+    }
+    result->frag_sum += frag;
+    result->frag_samples++;
+    if (frag > result->frag_max) {
+        result->frag_max = frag;
+    }
+    result->heap_size = usage.used_size + usage.free_size;
+    if (result->heap_size - usage.top_free > result->heap_top) {
+        result->heap_top = result->heap_size - usage.top_free;
+    }
+    return frag;
+}
+
+
+/*
+ * touch_payload:
+ * Writes one byte in every page of a payload and its last byte, the first
+ * time a page is written this takes a page fault.
+ */
+void touch_payload(char *ptr, int size) {
+    for (int i = 0; i < size; i += 4096) {
+        ptr[i] = (char)i;
+    }
+    ptr[size - 1] = 1;
+}
+
+
+/*
+ * open_tlb_counter:
+ * Opens a disabled counter of dTLB load misses in user space for this thread.
+ * Returns the counter's file descriptor or -1 if perf events are not available.
+ */
+int open_tlb_counter() {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+
+/*
+ * page_faults:
+ * Returns the number of page faults the process has taken so far.
+ */
+long page_faults() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_minflt + usage.ru_majflt;
+}
+
+
+/*
+ * replay:
+ * Replays the trace against the heap set up by init_heap. Each allocator
+ * call is timed on its own, fragmentation sampling is not timed.
+ */
+void replay(trace_t *trace, replay_result_t *result) {
+    void **ptrs = calloc(trace->num_ids, sizeof(void*));
+    int *sizes = calloc(trace->num_ids, sizeof(int));
+    long long live = 0;
+    long long t0 = 0;
+    long long t1 = 0;
+    trace_op_t *op;
+    void *ptr;
+    int tlb_fd = open_tlb_counter();
+
+    if (ptrs == NULL || sizes == NULL) {
+        exit(1);
+    }
+
+    result->page_faults = page_faults();
+    if (tlb_fd != -1) {
+        ioctl(tlb_fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(tlb_fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    for (int i = 0; i < trace->num_ops; i++) {
+        op = &trace->ops[i];
+        switch (op->type) {
+            case 'a':
+                t0 = now_ns();
+                ptr = balloc(op->size);
+                if (ptr == NULL && !immediate) { //a deferred heap may just need coalescing
+                    coalesce();
+                    ptr = balloc(op->size);
+                }
+                t1 = now_ns();
+                record(&result->lat[OP_ALLOC], t1 - t0);
+                if (ptr == NULL) {
+                    result->failed++;
+                } else {
+                    ptrs[op->id] = ptr;
+                    sizes[op->id] = op->size;
+                    live += op->size;
+                    if (touch) {
+                        long long t2 = now_ns();
+                        touch_payload(ptr, op->size);
+                        record(&result->lat[OP_TOUCH], now_ns() - t2);
+                    }
+                }
+                break;
+            case 'f':
+                if (ptrs[op->id] == NULL) { //allocation failed earlier
+                    continue;
+                }
+                t0 = now_ns();
+                bfree(ptrs[op->id]);
+                t1 = now_ns();
+                record(&result->lat[OP_FREE], t1 - t0);
+                ptrs[op->id] = NULL;
+                live -= sizes[op->id];
+                break;
+            case 'r':
+                if (ptrs[op->id] == NULL) {
+                    continue;
+                }
+                t0 = now_ns();
+                ptr = brealloc(ptrs[op->id], op->size);
+                t1 = now_ns();
+                record(&result->lat[OP_REALLOC], t1 - t0);
+                if (op->size == 0) { //brealloc to 0 frees the block
+                    ptrs[op->id] = NULL;
+                    live -= sizes[op->id];
+                    sizes[op->id] = 0;
+                } else if (ptr == NULL) {
+                    result->failed++;
+                } else {
+                    ptrs[op->id] = ptr;
+                    live += op->size - sizes[op->id];
+                    sizes[op->id] = op->size;
+                    if (touch) {
+                        long long t2 = now_ns();
+                        touch_payload(ptr, op->size);
+                        record(&result->lat[OP_TOUCH], now_ns() - t2);
+                    }
+                }
+                break;
+        }
+        result->seconds += (t1 - t0) / 1e9;
+        result->ops++;
+
+        if (coalesce_every > 0 && result->ops % coalesce_every == 0) {
+            t0 = now_ns();
+            coalesce();
+            t1 = now_ns();
+            record(&result->lat[OP_COALESCE], t1 - t0);
+            result->seconds += (t1 - t0) / 1e9;
+        }
+
+        if (live > result->peak_live) {
+            result->peak_live = live;
+            if (sample_every > 0) {
+                result->frag_at_peak = sample_fragmentation(result);
+            }
+        } else if (sample_every > 0 && result->ops % sample_every == 0) {
+            sample_fragmentation(result);
+        }
+    }
+    sample_fragmentation(result);
+
+    result->page_faults = page_faults() - result->page_faults;
+    result->tlb_misses = -1;
+    if (tlb_fd != -1) {
+        ioctl(tlb_fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(tlb_fd, &result->tlb_misses, sizeof(long long)) != sizeof(long long)) {
+            result->tlb_misses = -1;
+        }
+        close(tlb_fd);
+    }
+
+    free(ptrs);
+    free(sizes);
+}
+
+
+int compare_ll(const void *a, const void *b) {
+    long long x = *(const long long*)a;
+    long long y = *(const long long*)b;
+    return (x > y) - (x < y);
+}
+
+
+/*
+ * percentile:
+ * Returns the p-th percentile of sorted latencies.
+ */
+long long percentile(latency_t *lat, double p) {
+    int index = (int)(p / 100.0 * (lat->count - 1) + 0.5);
+    return lat->ns[index];
+}
+
+
+/*
+ * print_results:
+ * Prints throughput, latency percentiles and heap metrics of a replay.
+ */
+void print_results(replay_result_t *result) {
+    heapStats stats;
+
+    printf("heap setup: %.3f ms\n", result->init_seconds * 1e3);
+    printf("ops: %lld in %.3f s allocator time (%.2f Mops/s)\n", result->ops,
+           result->seconds, result->ops / result->seconds / 1e6);
+    printf("%-10s %10s %8s %8s %8s %8s %10s\n", "op", "count", "p50", "p90", "p99", "p99.9", "max (ns)");
+    for (int t = 0; t < NUM_OP_TYPES; t++) {
+        latency_t *lat = &result->lat[t];
+        if (lat->count == 0) {
+            continue;
+        }
+        qsort(lat->ns, lat->count, sizeof(long long), compare_ll);
+        printf("%-10s %10d %8lld %8lld %8lld %8lld %10lld\n", op_names[t], lat->count,
+               percentile(lat, 50), percentile(lat, 90), percentile(lat, 99),
+               percentile(lat, 99.9), lat->ns[lat->count - 1]);
+    }
+    printf("failed allocations: %lld\n", result->failed);
+    printf("page faults: %ld, dTLB load misses: ", result->page_faults);
+    if (result->tlb_misses < 0) {
+        printf("n/a\n");
+    } else {
+        printf("%lld\n", result->tlb_misses);
+    }
+    heap_stats(&stats);
+    printf("heap counters: %llu allocs, %llu frees, %llu reallocs, %llu failed, %llu coalesced\n",
+           stats.allocs, stats.frees, stats.reallocs, stats.failed_allocs, stats.coalesced);
+    printf("peak live payload: %lld bytes, heap size: %ld bytes, heap top: %ld bytes\n",
+           result->peak_live, result->heap_size, result->heap_top);
+    printf("peak utilization: %.1f%% of heap size, %.1f%% of heap top\n",
+           100.0 * result->peak_live / result->heap_size, 100.0 * result->peak_live / result->heap_top);
+    printf("external fragmentation: mean %.1f%%, max %.1f%%, at peak %.1f%%\n",
+           100.0 * result->frag_sum / result->frag_samples, 100.0 * result->frag_max,
+           100.0 * result->frag_at_peak);
+}
+
+
+/*
+ * print_usage:
+ * Print information on how to use the benchmark to standard output.
+ */
+void print_usage(char* argv[]) {
+    printf("Usage: %s [-hi] (-t <file> | -g <pattern>) [options]\n", argv[0]);
+    printf("Options:\n");
+    printf("  -h           Print this help message.\n");
+    printf("  -t <file>    Replay a trace file.\n");
+    printf("  -g <pattern> Generate a trace: lifo, fifo, random or prodcons.\n");
+    printf("  -n <num>     Operations to generate (default 1000000).\n");
+    printf("  -l <num>     Live blocks kept by the generator (default 10000).\n");
+    printf("  -m <num>     Smallest generated request (default 8).\n");
+    printf("  -M <num>     Largest generated request (default 512).\n");
+    printf("  -r <num>     Random seed (default 1).\n");
+    printf("  -o <file>    Write the generated trace to a file.\n");
+    printf("  -H <num>     Heap size in bytes (default 64 MiB).\n");
+    printf("  -G <num>     Let the heap grow up to this many bytes.\n");
+    printf("  -i           Immediate coalescing in bfree.\n");
+    printf("  -c <num>     Call coalesce() every num ops.\n");
+    printf("  -f <num>     Sample fragmentation every num ops, 0 to turn off (default 1000).\n");
+    printf("  -T           Write every page of new payloads and time it.\n");
+    printf("  -B <list>    Heap backing, comma separated: anon, hugetlb, thp, populate, lock.\n");
+    printf("  -P <policy>  Placement policy: best, first, next, good, or all to compare them.\n");
+    printf("\nExamples:\n");
+    printf("  linux>  %s -g random -n 1000000\n", argv[0]);
+    printf("  linux>  %s -i -t traces/server.trace\n", argv[0]);
+    printf("  linux>  %s -g random -T -B anon,thp,populate\n", argv[0]);
+    printf("  linux>  %s -g prodcons -P all\n", argv[0]);
+    exit(0);
+}
+
+
+/*
+ * parse_backing:
+ * Turns a comma separated list of backing options into CHEAP_MAP_ flags.
+ */
+int parse_backing(char *list) {
+    int flags = 0;
+
+    for (char *name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+        if (strcmp(name, "anon") == 0) {
+            flags |= CHEAP_MAP_ANON;
+        } else if (strcmp(name, "hugetlb") == 0) {
+            flags |= CHEAP_MAP_HUGETLB;
+        } else if (strcmp(name, "thp") == 0) {
+            flags |= CHEAP_MAP_THP;
+        } else if (strcmp(name, "populate") == 0) {
+            flags |= CHEAP_MAP_POPULATE;
+        } else if (strcmp(name, "lock") == 0) {
+            flags |= CHEAP_MAP_LOCK;
+        } else {
+            fprintf(stderr, "Unknown backing %s\n", name);
+            exit(1);
+        }
+    }
+    return flags;
+}
+
+
+/*
+ * parse_policy:
+ * Turns a placement policy name into its CHEAP_FIT_ value, NUM_POLICIES for all.
+ */
+int parse_policy(char *name) {
+    for (int p = 0; p < NUM_POLICIES; p++) {
+        if (strcmp(name, policy_names[p]) == 0) {
+            return p;
+        }
+    }
+    if (strcmp(name, "all") == 0) {
+        return NUM_POLICIES;
+    }
+    fprintf(stderr, "Unknown placement policy %s\n", name);
+    exit(1);
+}
+
+
+/*
+ * run_benchmark:
+ * Sets up the heap, replays the trace, prints the results and fills in
+ * the summary used to compare policies.
+ */
+void run_benchmark(trace_t *trace, policy_summary_t *summary) {
+    replay_result_t result = {0};
+
+    result.init_seconds = now_ns() / 1e9;
+    if (init_heap_opts(heap_size, heap_max, map_flags) != 0) {
+        exit(1);
+    }
+    result.init_seconds = now_ns() / 1e9 - result.init_seconds;
+    set_coalesce_mode(immediate);
+    if (fit_policy >= 0) {
+        set_fit_policy(fit_policy);
+    }
+
+    replay(trace, &result);
+    print_results(&result);
+
+    summary->mops = result.ops / result.seconds / 1e6;
+    summary->alloc_p99 = result.lat[OP_ALLOC].count > 0 ? percentile(&result.lat[OP_ALLOC], 99) : 0;
+    summary->failed = result.failed;
+    summary->util_top = (double)result.peak_live / result.heap_top;
+    summary->frag_mean = result.frag_sum / result.frag_samples;
+    summary->frag_at_peak = result.frag_at_peak;
+}
+
+
+/*
+ * compare_policies:
+ * Replays the trace once per placement policy. The heap can only be set up
+ * once per process, so every run happens in a child that sends its
+ * summary back through a pipe.
+ */
+void compare_policies(trace_t *trace) {
+    policy_summary_t summary[NUM_POLICIES];
+    int fds[2];
+    pid_t pid;
+
+    for (int p = 0; p < NUM_POLICIES; p++) {
+        memset(&summary[p], 0, sizeof(policy_summary_t));
+        if (pipe(fds) != 0) {
+            exit(1);
+        }
+        fflush(stdout);
+        pid = fork();
+        if (pid < 0) {
+            exit(1);
+        }
+        if (pid == 0) {
+            close(fds[0]);
+            fit_policy = p;
+            printf("== %s fit ==\n", policy_names[p]);
+            run_benchmark(trace, &summary[p]);
+            fflush(stdout);
+            if (write(fds[1], &summary[p], sizeof(policy_summary_t)) != sizeof(policy_summary_t)) {
+                _exit(1);
+            }
+            _exit(0);
+        }
+        close(fds[1]);
+        if (read(fds[0], &summary[p], sizeof(policy_summary_t)) != sizeof(policy_summary_t)) {
+            fprintf(stderr, "%s fit run failed\n", policy_names[p]);
+        }
+        close(fds[0]);
+        waitpid(pid, NULL, 0);
+        printf("\n");
+    }
+
+    printf("%-8s %10s %12s %8s %10s %10s %10s\n", "policy", "Mops/s", "balloc p99", "failed",
+           "util top", "frag mean", "frag peak");
+    for (int p = 0; p < NUM_POLICIES; p++) {
+        printf("%-8s %10.2f %12lld %8lld %9.1f%% %9.1f%% %9.1f%%\n", policy_names[p], summary[p].mops,
+               summary[p].alloc_p99, summary[p].failed, 100.0 * summary[p].util_top,
+               100.0 * summary[p].frag_mean, 100.0 * summary[p].frag_at_peak);
+    }
+}
+
+
+/*
+ * main:
+ * Parses command line args, builds or reads the trace, sets up the heap,
+ * replays the trace and prints the results.
+ */
+int main(int argc, char* argv[]) {
+    char *trace_file = NULL;
+    char *pattern = NULL;
+    char *out_file = NULL;
+    int num_ops = 1000000;
+    unsigned int seed = 1;
+    trace_t trace = {0};
+    policy_summary_t summary;
+    int c;
+
+    while ((c = getopt(argc, argv, "t:g:n:l:m:M:r:o:H:G:ic:f:TB:P:h")) != -1) {
+        switch (c) {
+            case 't': trace_file = optarg; break;
+            case 'g': pattern = optarg; break;
+            case 'n': num_ops = atoi(optarg); break;
+            case 'l': live_target = atoi(optarg); break;
+            case 'm': min_size = atoi(optarg); break;
+            case 'M': max_size = atoi(optarg); break;
+            case 'r': seed = atoi(optarg); break;
+            case 'o': out_file = optarg; break;
+            case 'H': heap_size = atol(optarg); break;
+            case 'G': heap_max = atol(optarg); break;
+            case 'i': immediate = 1; break;
+            case 'c': coalesce_every = atoi(optarg); break;
+            case 'f': sample_every = atoi(optarg); break;
+            case 'T': touch = 1; break;
+            case 'B': map_flags = parse_backing(optarg); break;
+            case 'P': fit_policy = parse_policy(optarg); break;
+            case 'h':
+                print_usage(argv);
+                exit(0);
+            default:
+                print_usage(argv);
+                exit(1);
+        }
+    }
+
+    if ((trace_file == NULL) == (pattern == NULL) || min_size < 1 || max_size < min_size || live_target < 1) {
+        printf("%s: Give either a trace file or a pattern\n", argv[0]);
+        print_usage(argv);
+        exit(1);
+    }
+
+    if (trace_file != NULL) {
+        read_trace(&trace, trace_file);
+    } else {
+        srand(seed);
+        generate_trace(&trace, pattern, num_ops);
+    }
+    if (out_file != NULL) {
+        write_trace(&trace, out_file);
+    }
+
+    if (fit_policy == NUM_POLICIES) {
+        compare_policies(&trace);
+    } else {
+        run_benchmark(&trace, &summary);
+    }
+    return 0;
+}
@@ -2,7 +2,35 @@
  * csim.c:  
  * A cache simulator that can replay traces (from Valgrind) and output
  * statistics for the number of hits, misses, and evictions.
- * The replacement policy is LRU.
+ * The replacement policy is LRU unless -p picks another one: fifo, random,
+ * plru, lfu, srrip, brrip or opt (Belady's optimal policy, which looks
+ * ahead in the trace). -p all replays the trace once per policy and
+ * reports how many more misses each one has than opt.
+ *
+ * -s, -E and -b also take ranges (lo-hi or lo-hi:step). The trace is then
+ * read once and every configuration in the ranges is simulated on its own
+ * thread, printing one CSV or JSON table instead of the usual summary.
+ * -m gets the same LRU table for every E in one pass per s and b from the
+ * stack distances of the accesses, plus a fully associative curve.
+ *
+ * An access is counted against the block of its address only, like the
+ * trace format assumes. -B splits it into one access per block of
+ * [addr, addr+len) instead, so unaligned accesses touch every block they
+ * cover. Without it the counts stay comparable with older runs.
+ *
+ * Stores mark lines dirty and dirty lines evicted are written back to
+ * memory. -w through writes every store through to memory instead and
+ * -a no-allocate sends store misses to memory without filling a line.
+ * Lines still dirty at the end are written back too. With -w, -a or -v a
+ * second line reports the write-backs and the bytes written to memory.
+ *
+ * -L simulates a hierarchy of up to MAX_LEVELS write-back caches instead,
+ * each given as s,E,b[,policy[,latency]], see the hierarchy section below.
+ *
+ * Build:
+ *   gcc -O2 -pthread -o csim CacheSimulator.c -lm
+ * Tags are compared with AVX2 or SSE4.1 when the CPU has them, no extra
+ * compiler flags are needed for that.
  */  
 
 #include <getopt.h>
@@ -15,6 +43,10 @@
 #include <string.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
 
 /******************************************************************************/
 /* DO NOT MODIFY THESE VARIABLES **********************************************/
@@ -29,12 +61,10 @@ int B; //block size in bytes: B = 2^b
 int S; //number of sets: S = 2^s
 
 //Global counters to track cache statistics in access_data().
-int hit_cnt = 0;
-int miss_cnt = 0;
-int evict_cnt = 0;
-
-//global variable that I added to keep track of current maximum
-int currMax = 1;
+//64-bit so traces with billions of accesses are counted correctly.
+long long hit_cnt = 0;
+long long miss_cnt = 0;
+long long evict_cnt = 0;
 
 //Global to control trace output
 int verbosity = 0; //print trace if set
@@ -44,22 +74,445 @@ int verbosity = 0; //print trace if set
 //Type mem_addr_t: Use when dealing with addresses or address masks.
 typedef unsigned long long int mem_addr_t;
 
-//Type cache_line_t: Use when dealing with cache lines.
-typedef struct cache_line {                    
-    char valid;
-    mem_addr_t tag;
-    int lruCounter; //keeps track of the current position in the least recently used queue
-} cache_line_t;
+/*
+ * Type cache_t: Use when dealing with the cache.
+ * The cache is one structure of arrays instead of an array of separately
+ * allocated sets, so the tags a lookup compares sit next to each other.
+ * Line i of set n is entry n * stride + i of tags, lruPrev, lruNext and
+ * meta, the valid bit of that line is bit i of the valid words of set n. stride is
+ * E rounded up to a multiple of TAG_GROUP so a set can be compared a whole
+ * vector at a time, the padding lines are never valid.
+ */
+#define TAG_GROUP 4
+
+typedef struct cache {
+    int s;                     //number of set bits
+    int E;                     //number of lines per set
+    int b;                     //number of block bits
+    int stride;                //tag slots per set
+    int valid_words;           //64-bit valid words per set
+    mem_addr_t *tags;          //tag of every line
+    unsigned long long *valid; //valid bits of every set
+    unsigned long long *dirty; //dirty bits of every set, laid out like valid
+    int *lruPrev;              //next more recently used line of the same set, -1 for the head
+    int *lruNext;              //next less recently used line of the same set, -1 for the tail
+    int *lruHead;              //most recently used line of every set, -1 if the set is empty
+    int *lruTail;              //least recently used line of every set, the next one to evict
+    const struct policy *policy; //replacement policy
+    unsigned long long *meta;  //state the policy keeps for every line
+    unsigned long long *setBits; //state the policy keeps for every set, set_words words each
+    int set_words;
+    unsigned long long rng;    //random number state of the random and brrip policies
+    const long long *nextUse;  //opt only, for every access the index of the next access to the same block
+    long long clock;           //number of accesses so far
+    long long hits;
+    long long misses;
+    long long evictions;
+    int write_through;         //stores also go to memory and leave lines clean
+    int no_write_allocate;     //a store miss goes to memory and leaves the cache alone
+    long long dirty_evictions;
+    long long dirty_flushed;   //lines still dirty when the trace ended, written back by cache_flush
+    long long bytes_written;   //bytes written to memory: written back dirty blocks and written through stores
+} cache_t;
+
+/*
+ * Type policy_t: a replacement policy. It keeps whatever state it needs in
+ * the LRU lists, meta and setBits and is told about every change to a set:
+ *   hit:    'line' was accessed again
+ *   fill:   'line' was just filled after a miss
+ *   victim: returns the line to evict from a full set
+ *   remove: 'line' leaves the set, right before it is refilled
+ */
+typedef struct policy {
+    const char *name;
+    void (*hit)(cache_t *c, int setNum, int line);
+    void (*fill)(cache_t *c, int setNum, int line);
+    int (*victim)(cache_t *c, int setNum);
+    void (*remove)(cache_t *c, int setNum, int line);
+} policy_t;
+
+//Seed of the random and brrip policies, fixed so runs can be repeated.
+#define RANDOM_SEED 0x9e3779b97f4a7c15ULL
 
-//Type cache_set_t: Use when dealing with cache sets
-typedef cache_line_t* cache_set_t;
+//Type access_t: outcome of one cache access.
+typedef enum { ACCESS_HIT, ACCESS_MISS, ACCESS_EVICT } access_t;
 
-//Type cache_t: Use when dealing with the cache.
-typedef cache_set_t* cache_t;
+//Type victim_t: the block a fill pushed out of the cache.
+typedef struct victim {
+    mem_addr_t addr;
+    int dirty;
+} victim_t;
 
 // Create the cache we're simulating. 
 cache_t cache;  
 
+/*
+ * find_tag:
+ * Returns the line of a set whose tag is 'tag' and whose valid bit is set,
+ * or -1 if there is none. Picked in cache_init from the versions below
+ * by what the CPU supports.
+ */
+int (*find_tag)(const mem_addr_t *tags, const unsigned long long *valid, int stride, mem_addr_t tag) = NULL;
+
+//Scalar version, only looks at lines with their valid bit set.
+int find_tag_scalar(const mem_addr_t *tags, const unsigned long long *valid, int stride, mem_addr_t tag) {
+    for(int w = 0; w * 64 < stride; w++) {
+        for(unsigned long long bits = valid[w]; bits != 0; bits &= bits - 1) {
+            int line = w * 64 + __builtin_ctzll(bits);
+            if(tags[line] == tag) {
+                return line;
+            }
+        }
+    }
+    return -1;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+//AVX2 version, compares 4 tags per instruction.
+__attribute__((target("avx2")))
+int find_tag_avx2(const mem_addr_t *tags, const unsigned long long *valid, int stride, mem_addr_t tag) {
+    __m256i key = _mm256_set1_epi64x((long long)tag);
+    for(int i = 0; i < stride; i += 4) {
+        __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(tags + i)), key);
+        int match = _mm256_movemask_pd(_mm256_castsi256_pd(eq)) & (int)((valid[i >> 6] >> (i & 63)) & 0xf);
+        if(match) {
+            return i + __builtin_ctz(match);
+        }
+    }
+    return -1;
+}
+
+//SSE4.1 version, compares 2 tags per instruction.
+__attribute__((target("sse4.1")))
+int find_tag_sse(const mem_addr_t *tags, const unsigned long long *valid, int stride, mem_addr_t tag) {
+    __m128i key = _mm_set1_epi64x((long long)tag);
+    for(int i = 0; i < stride; i += 2) {
+        __m128i eq = _mm_cmpeq_epi64(_mm_loadu_si128((const __m128i*)(tags + i)), key);
+        int match = _mm_movemask_pd(_mm_castsi128_pd(eq)) & (int)((valid[i >> 6] >> (i & 63)) & 0x3);
+        if(match) {
+            return i + __builtin_ctz(match);
+        }
+    }
+    return -1;
+}
+#endif
+
+/*
+ * select_find_tag:
+ * Points find_tag at the fastest version this CPU runs. Called by the
+ * first cache_init, or before any threads start when there are several.
+ */
+void select_find_tag() {
+    find_tag = find_tag_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        find_tag = find_tag_avx2;
+    } else if(__builtin_cpu_supports("sse4.1")) {
+        find_tag = find_tag_sse;
+    }
+#endif
+}
+
+/*
+ * cache_init:
+ * Allocates a cache with 2^s sets of E lines and 2^b byte blocks that
+ * replaces lines with 'policy'.
+ * Every line starts out invalid.
+ */
+void cache_init(cache_t *c, int s, int E, int b, const policy_t *policy) {
+    memset(c, 0, sizeof(cache_t));
+    c->s = s;
+    c->E = E;
+    c->b = b;
+    c->stride = (E + TAG_GROUP - 1) / TAG_GROUP * TAG_GROUP;
+    c->valid_words = (c->stride + 63) / 64;
+    c->set_words = (2 * c->stride + 63) / 64; //room for a tree over the lines of a set
+    c->policy = policy;
+    c->rng = RANDOM_SEED;
+
+    //calloc leaves every tag 0 and every valid bit cleared
+    c->tags = calloc((size_t)c->stride << s, sizeof(mem_addr_t));
+    c->valid = calloc((size_t)c->valid_words << s, sizeof(unsigned long long));
+    c->dirty = calloc((size_t)c->valid_words << s, sizeof(unsigned long long));
+    c->lruPrev = malloc(((size_t)c->stride << s) * sizeof(int));
+    c->lruNext = malloc(((size_t)c->stride << s) * sizeof(int));
+    c->lruHead = malloc(((size_t)1 << s) * sizeof(int));
+    c->lruTail = malloc(((size_t)1 << s) * sizeof(int));
+    c->meta = calloc((size_t)c->stride << s, sizeof(unsigned long long));
+    c->setBits = calloc((size_t)c->set_words << s, sizeof(unsigned long long));
+    if(c->tags == NULL || c->valid == NULL || c->dirty == NULL || c->lruPrev == NULL || c->lruNext == NULL ||
+       c->lruHead == NULL || c->lruTail == NULL || c->meta == NULL || c->setBits == NULL) { //check that it was allocated correctly
+        exit(1);
+    }
+    //every LRU list starts out empty
+    memset(c->lruHead, -1, ((size_t)1 << s) * sizeof(int));
+    memset(c->lruTail, -1, ((size_t)1 << s) * sizeof(int));
+
+    if(find_tag == NULL) {
+        select_find_tag();
+    }
+}
+
+/*
+ * cache_free:
+ * Frees the arrays of a cache made by cache_init.
+ */
+void cache_free(cache_t *c) {
+    free(c->tags);
+    free(c->valid);
+    free(c->dirty);
+    free(c->lruPrev);
+    free(c->lruNext);
+    free(c->lruHead);
+    free(c->lruTail);
+    free(c->meta);
+    free(c->setBits);
+    c->tags = NULL;
+    c->valid = c->dirty = NULL;
+    c->lruPrev = c->lruNext = c->lruHead = c->lruTail = NULL;
+    c->meta = c->setBits = NULL;
+}
+
+
+/*
+ * LRU order of a set is kept as a doubly linked list through the lines of
+ * the set, most recently used first. A hit moves its line to the front
+ * and the victim is always the tail, so both take constant time whatever E is.
+ */
+
+/*
+ * lru_unlink:
+ * Takes 'line' of set 'setNum' out of the LRU list of the set.
+ */
+void lru_unlink(cache_t *c, int setNum, int line) {
+    int *prev = c->lruPrev + (size_t)setNum * c->stride;
+    int *next = c->lruNext + (size_t)setNum * c->stride;
+
+    if(prev[line] >= 0) {
+        next[prev[line]] = next[line];
+    } else {
+        c->lruHead[setNum] = next[line];
+    }
+    if(next[line] >= 0) {
+        prev[next[line]] = prev[line];
+    } else {
+        c->lruTail[setNum] = prev[line];
+    }
+}
+
+/*
+ * lru_push_front:
+ * Makes 'line' of set 'setNum' the most recently used line of the set.
+ */
+void lru_push_front(cache_t *c, int setNum, int line) {
+    int *prev = c->lruPrev + (size_t)setNum * c->stride;
+    int *next = c->lruNext + (size_t)setNum * c->stride;
+    int head = c->lruHead[setNum];
+
+    prev[line] = -1;
+    next[line] = head;
+    if(head >= 0) {
+        prev[head] = line;
+    } else {
+        c->lruTail[setNum] = line;
+    }
+    c->lruHead[setNum] = line;
+}
+
+
+/*
+ * Replacement policies, see policy_t. A policy only ever sees sets whose
+ * lines 0 to E-1 are all valid when it is asked for a victim.
+ */
+
+void policy_nop(cache_t *c, int setNum, int line) {
+    (void)c;
+    (void)setNum;
+    (void)line;
+}
+
+/*
+ * next_random:
+ * Returns the next number of the xorshift64* generator of cache 'c'.
+ */
+unsigned long long next_random(cache_t *c) {
+    c->rng ^= c->rng >> 12;
+    c->rng ^= c->rng << 25;
+    c->rng ^= c->rng >> 27;
+    return c->rng * 0x2545f4914f6cdd1dULL;
+}
+
+//LRU: evict the line used longest ago, a hit moves its line to the front.
+void lru_hit(cache_t *c, int setNum, int line) {
+    if(c->lruHead[setNum] != line) {
+        lru_unlink(c, setNum, line);
+        lru_push_front(c, setNum, line);
+    }
+}
+
+int lru_victim(cache_t *c, int setNum) {
+    return c->lruTail[setNum];
+}
+
+//FIFO: evict the line filled longest ago, hits do not change the order.
+
+//Random: evict any line.
+int random_victim(cache_t *c, int setNum) {
+    (void)setNum;
+    return next_random(c) % c->E;
+}
+
+/*
+ * Tree-PLRU: the setBits of a set are a binary tree over its lines (node 1
+ * is the root, the children of node n are 2n and 2n+1 and the leaves are
+ * the lines). Every node points to the half that was used less recently,
+ * an access flips the nodes on its path to point away from it and the
+ * victim is found by following the pointers from the root. If E is not a
+ * power of two the leaves past E are never chosen.
+ */
+int plru_leaves(cache_t *c) {
+    int leaves = 1;
+    while(leaves < c->E) {
+        leaves *= 2;
+    }
+    return leaves;
+}
+
+void plru_hit(cache_t *c, int setNum, int line) {
+    unsigned long long *bits = c->setBits + (size_t)setNum * c->set_words;
+    int node = plru_leaves(c) + line;
+
+    for(; node > 1; node /= 2) {
+        int parent = node / 2;
+        if(node & 1) { //right child was used, point left
+            bits[parent >> 6] &= ~(1ULL << (parent & 63));
+        } else {
+            bits[parent >> 6] |= 1ULL << (parent & 63);
+        }
+    }
+}
+
+int plru_victim(cache_t *c, int setNum) {
+    unsigned long long *bits = c->setBits + (size_t)setNum * c->set_words;
+    int leaves = plru_leaves(c);
+    int node = 1;
+    int first = 0; //first line below node
+    int span = leaves;
+
+    while(node < leaves) {
+        span /= 2;
+        int right = (bits[node >> 6] >> (node & 63)) & 1;
+        if(right && first + span >= c->E) { //right half holds no lines
+            right = 0;
+        }
+        node = 2 * node + right;
+        first += right * span;
+    }
+    return node - leaves;
+}
+
+//LFU: evict the line with the fewest hits since it was filled, the least recently used of those on a tie.
+void lfu_hit(cache_t *c, int setNum, int line) {
+    c->meta[(size_t)setNum * c->stride + line]++;
+    lru_hit(c, setNum, line);
+}
+
+void lfu_fill(cache_t *c, int setNum, int line) {
+    c->meta[(size_t)setNum * c->stride + line] = 1;
+    lru_push_front(c, setNum, line);
+}
+
+int lfu_victim(cache_t *c, int setNum) {
+    unsigned long long *count = c->meta + (size_t)setNum * c->stride;
+    int *prev = c->lruPrev + (size_t)setNum * c->stride;
+    int victim = c->lruTail[setNum];
+
+    for(int line = prev[victim]; line >= 0; line = prev[line]) {
+        if(count[line] < count[victim]) {
+            victim = line;
+        }
+    }
+    return victim;
+}
+
+/*
+ * SRRIP and BRRIP: meta holds a 2-bit re-reference prediction value, a hit
+ * predicts a near re-reference (0). SRRIP fills lines with a long
+ * prediction (RRPV_MAX - 1), BRRIP with a distant one (RRPV_MAX) and only
+ * once every BRRIP_LONG fills with a long one, so scans do not flush the
+ * set. The victim is a line predicted distant, all lines age until one is.
+ */
+#define RRPV_MAX 3
+#define BRRIP_LONG 32
+
+void rrip_hit(cache_t *c, int setNum, int line) {
+    c->meta[(size_t)setNum * c->stride + line] = 0;
+}
+
+void srrip_fill(cache_t *c, int setNum, int line) {
+    c->meta[(size_t)setNum * c->stride + line] = RRPV_MAX - 1;
+}
+
+void brrip_fill(cache_t *c, int setNum, int line) {
+    c->meta[(size_t)setNum * c->stride + line] = next_random(c) % BRRIP_LONG == 0 ? RRPV_MAX - 1 : RRPV_MAX;
+}
+
+int rrip_victim(cache_t *c, int setNum) {
+    unsigned long long *rrpv = c->meta + (size_t)setNum * c->stride;
+
+    for(;;) {
+        for(int line = 0; line < c->E; line++) {
+            if(rrpv[line] >= RRPV_MAX) {
+                return line;
+            }
+        }
+        for(int line = 0; line < c->E; line++) {
+            rrpv[line]++;
+        }
+    }
+}
+
+//OPT: meta holds when the block in a line is used next, evict the one used furthest in the future.
+void opt_hit(cache_t *c, int setNum, int line) {
+    c->meta[(size_t)setNum * c->stride + line] = c->nextUse[c->clock - 1];
+}
+
+int opt_victim(cache_t *c, int setNum) {
+    unsigned long long *next = c->meta + (size_t)setNum * c->stride;
+    int victim = 0;
+
+    for(int line = 1; line < c->E; line++) {
+        if(next[line] > next[victim]) {
+            victim = line;
+        }
+    }
+    return victim;
+}
+
+#define NUM_POLICIES 8
+#define POLICY_OPT (NUM_POLICIES - 1)
+
+const policy_t policies[NUM_POLICIES] = {
+    {"lru",    lru_hit,    lru_push_front, lru_victim,    lru_unlink},
+    {"fifo",   policy_nop, lru_push_front, lru_victim,    lru_unlink},
+    {"random", policy_nop, policy_nop,     random_victim, policy_nop},
+    {"plru",   plru_hit,   plru_hit,       plru_victim,   policy_nop},
+    {"lfu",    lfu_hit,    lfu_fill,       lfu_victim,    lru_unlink},
+    {"srrip",  rrip_hit,   srrip_fill,     rrip_victim,   policy_nop},
+    {"brrip",  rrip_hit,   brrip_fill,     rrip_victim,   policy_nop},
+    {"opt",    opt_hit,    opt_hit,        opt_victim,    policy_nop},
+};
+
+//Replacement policy of the cache, set by -p.
+const policy_t *replacement = &policies[0];
+
+//Write policy of the cache, set by -w and -a.
+int write_through = 0;
+int no_write_allocate = 0;
+
 /* 
  * init_cache:
  * Allocates the data structure for a cache with S sets and E lines per set.
@@ -70,179 +523,998 @@ void init_cache() {
     B = pow(2, b);
     S = pow(2, s);
 
-    //allocate space for the cache sets
-    cache = malloc(sizeof(cache_set_t) * S);
-    if(cache == NULL) { //check that if was allocated correctly
+    cache_init(&cache, s, E, b, replacement);
+    cache.write_through = write_through;
+    cache.no_write_allocate = no_write_allocate;
+}
+  
+
+/* 
+ * free_cache:
+ * Frees all heap allocated memory used by the cache.
+ */                    
+void free_cache() {
+    cache_free(&cache);
+}
+
+
+/*
+ * cache_set:
+ * Returns the set 'addr' maps to.
+ */
+int cache_set(cache_t *c, mem_addr_t addr) {
+    return (addr >> c->b) & ((1ULL << c->s) - 1);
+}
+
+/*
+ * cache_find:
+ * Returns the line of set 'setNum' that holds 'addr', -1 if it is not
+ * cached. Changes nothing.
+ */
+int cache_find(cache_t *c, int setNum, mem_addr_t addr) {
+    return find_tag(c->tags + (size_t)setNum * c->stride, c->valid + (size_t)setNum * c->valid_words,
+                    c->stride, addr >> (c->b + c->s));
+}
+
+/*
+ * cache_set_dirty:
+ * Marks line 'line' of set 'setNum' as written to.
+ */
+void cache_set_dirty(cache_t *c, int setNum, int line) {
+    c->dirty[(size_t)setNum * c->valid_words + (line >> 6)] |= 1ULL << (line & 63);
+}
+
+/*
+ * cache_fill:
+ * Puts the block of 'addr', which must not be cached, into set 'setNum':
+ * into the first line with a valid bit of 0, or else in place of the line
+ * the policy picks. Returns ACCESS_EVICT and the block that was evicted in
+ * *victim (if not NULL) when it had to evict, ACCESS_MISS otherwise.
+ * Counts nothing.
+ */
+access_t cache_fill(cache_t *c, int setNum, mem_addr_t addr, int dirty, victim_t *victim) {
+    mem_addr_t tNum = addr >> (c->b + c->s);
+    mem_addr_t *tags = c->tags + (size_t)setNum * c->stride;
+    unsigned long long *valid = c->valid + (size_t)setNum * c->valid_words;
+    unsigned long long *dirtyBits = c->dirty + (size_t)setNum * c->valid_words;
+    unsigned long long dirtyBit = dirty != 0;
+    int line;
+
+    //take the first line with a valid bit of 0
+    for(int w = 0; w < c->valid_words; w++) {
+        unsigned long long freeBits = ~valid[w];
+        if(w == c->valid_words - 1 && c->E - w * 64 < 64) { //padding lines are not part of the set
+            freeBits &= (1ULL << (c->E - w * 64)) - 1;
+        }
+        if(freeBits != 0) {
+            line = w * 64 + __builtin_ctzll(freeBits);
+            valid[w] |= 1ULL << (line & 63);
+            dirtyBits[w] = (dirtyBits[w] & ~(1ULL << (line & 63))) | dirtyBit << (line & 63);
+            tags[line] = tNum;
+            c->policy->fill(c, setNum, line);
+            return ACCESS_MISS;
+        }
+    }
+
+    //no free space in the set, let the policy pick a line to evict and refill it
+    line = c->policy->victim(c, setNum);
+    if(victim != NULL) {
+        victim->addr = ((tags[line] << c->s) | setNum) << c->b;
+        victim->dirty = (dirtyBits[line >> 6] >> (line & 63)) & 1;
+    }
+    c->policy->remove(c, setNum, line);
+    tags[line] = tNum;
+    dirtyBits[line >> 6] = (dirtyBits[line >> 6] & ~(1ULL << (line & 63))) | dirtyBit << (line & 63);
+    c->policy->fill(c, setNum, line);
+    return ACCESS_EVICT;
+}
+
+/*
+ * cache_invalidate:
+ * Drops the block of 'addr' from the cache. Returns 1 and whether it was
+ * dirty in *dirty if it was cached, 0 if not.
+ */
+int cache_invalidate(cache_t *c, mem_addr_t addr, int *dirty) {
+    int setNum = cache_set(c, addr);
+    int line = cache_find(c, setNum, addr);
+
+    if(line < 0) {
+        return 0;
+    }
+    size_t w = (size_t)setNum * c->valid_words + (line >> 6);
+    *dirty = (c->dirty[w] >> (line & 63)) & 1;
+    c->policy->remove(c, setNum, line);
+    c->valid[w] &= ~(1ULL << (line & 63));
+    c->dirty[w] &= ~(1ULL << (line & 63));
+    return 1;
+}
+
+/*
+ * cache_miss_fill:
+ * Brings the block of 'addr' into set 'setNum' after a miss and writes back
+ * the block it evicts if that was dirty.
+ */
+access_t cache_miss_fill(cache_t *c, int setNum, mem_addr_t addr, int dirty) {
+    victim_t victim;
+
+    if(cache_fill(c, setNum, addr, dirty, &victim) == ACCESS_EVICT) {
+        c->evictions++;
+        if(victim.dirty) {
+            c->dirty_evictions++;
+            c->bytes_written += 1LL << c->b;
+        }
+        return ACCESS_EVICT;
+    }
+    return ACCESS_MISS;
+}
+
+/*
+ * cache_flush:
+ * Writes back every line of cache 'c' that is still dirty, like at the end
+ * of a run, so write-back and write-through count the same bytes.
+ */
+void cache_flush(cache_t *c) {
+    size_t words = (size_t)c->valid_words << c->s;
+
+    for(size_t w = 0; w < words; w++) {
+        long long lines = __builtin_popcountll(c->dirty[w]);
+        c->dirty_flushed += lines;
+        c->bytes_written += lines << c->b;
+        c->dirty[w] = 0;
+    }
+}
+
+/*
+ * cache_access:
+ * Simulates data access at given "addr" memory address in cache 'c'.
+ * Returns whether it hit, missed into an invalid line or evicted a line.
+ */
+access_t cache_access(cache_t *c, mem_addr_t addr) {
+    int setNum = cache_set(c, addr);
+
+    c->clock++;
+
+    //look through the set to find if its already in the cache
+    int line = cache_find(c, setNum, addr);
+    if(line >= 0) {
+        c->policy->hit(c, setNum, line);
+        c->hits++;
+        return ACCESS_HIT;
+    }
+    c->misses++;
+
+    return cache_miss_fill(c, setNum, addr, 0);
+}
+
+/*
+ * cache_store:
+ * Like cache_access for a store of 'len' bytes at 'addr', following the
+ * write policy of cache 'c'.
+ */
+access_t cache_store(cache_t *c, mem_addr_t addr, unsigned int len) {
+    int setNum = cache_set(c, addr);
+
+    c->clock++;
+    if(c->write_through) {
+        c->bytes_written += len;
+    }
+
+    int line = cache_find(c, setNum, addr);
+    if(line >= 0) {
+        c->policy->hit(c, setNum, line);
+        c->hits++;
+        if(!c->write_through) {
+            cache_set_dirty(c, setNum, line);
+        }
+        return ACCESS_HIT;
+    }
+    c->misses++;
+
+    if(c->no_write_allocate) {
+        if(!c->write_through) { //not counted above yet
+            c->bytes_written += len;
+        }
+        return ACCESS_MISS;
+    }
+    return cache_miss_fill(c, setNum, addr, !c->write_through);
+}
+
+
+/*
+ * A hierarchy of write-back, write-allocate caches: level 0 is L1, which
+ * sees every access, and a miss at a level is looked up in the next one
+ * down and then in memory. The levels relate to each other in one of
+ * three ways:
+ *   nine:      non-inclusive non-exclusive, a miss fills every level it
+ *              went through and evictions only write dirty blocks back.
+ *   inclusive: like nine, but a block evicted from a level is also dropped
+ *              from the levels above it (back-invalidation), so every block
+ *              of a level is in all levels below it.
+ *   exclusive: a block is in at most one level. A miss fills L1 only, a
+ *              hit below L1 moves the block up and every level's victims
+ *              move one level down. Needs the same b at all levels.
+ * Block sizes must not shrink going down. The cost of an access is the
+ * latency of every level looked at plus the memory latency if all missed.
+ */
+#define MAX_LEVELS 4
+#define DEFAULT_MEM_LATENCY 200
+
+typedef enum { INCLUSION_NINE, INCLUSION_INCLUSIVE, INCLUSION_EXCLUSIVE } inclusion_t;
+
+typedef struct level {
+    cache_t cache;             //its hits, misses and evictions are the counts of this level
+    int s, E, b;
+    const policy_t *policy;
+    int latency;               //cycles to look a block up in this level
+    long long writebacks;      //blocks written to the level below, in an exclusive hierarchy every victim that is kept
+    long long back_invalidations; //inclusive only, blocks this level dropped from the levels above
+} level_t;
+
+typedef struct hierarchy {
+    int num_levels;
+    level_t levels[MAX_LEVELS];
+    inclusion_t inclusion;
+    int mem_latency;
+    long long mem_reads;       //blocks read from memory
+    long long mem_writes;      //blocks written back to memory
+    long long accesses;
+    long long cycles;          //total cost of all accesses
+} hierarchy_t;
+
+//Default latency of every level in cycles.
+const int default_latency[MAX_LEVELS] = {4, 12, 40, 80};
+
+//The hierarchy given with -L, no levels means a single cache.
+hierarchy_t hierarchy;
+
+/*
+ * add_level:
+ * Adds a level below the others from "s,E,b[,policy[,latency]]".
+ * Returns 0 on success, -1 on a bad spec or too many levels.
+ */
+int add_level(hierarchy_t *h, const char *spec) {
+    char policy_name[16] = "lru";
+    level_t *level = &h->levels[h->num_levels];
+    int fields;
+
+    if(h->num_levels == MAX_LEVELS) {
+        return -1;
+    }
+    memset(level, 0, sizeof(level_t));
+    level->latency = default_latency[h->num_levels];
+    fields = sscanf(spec, "%d,%d,%d,%15[a-z],%d", &level->s, &level->E, &level->b, policy_name, &level->latency);
+    if(fields < 3 || level->s < 0 || level->E < 1 || level->b < 0 || level->s + level->b >= 64 || level->latency < 0) {
+        return -1;
+    }
+    for(int p = 0; p < NUM_POLICIES; p++) {
+        if(p != POLICY_OPT && strcmp(policy_name, policies[p].name) == 0) { //opt can't look ahead at the accesses of lower levels
+            level->policy = &policies[p];
+        }
+    }
+    if(level->policy == NULL) {
+        return -1;
+    }
+    h->num_levels++;
+    return 0;
+}
+
+/*
+ * init_hierarchy:
+ * Makes the caches of every level. Returns -1 if the block sizes don't fit
+ * the inclusion policy.
+ */
+int init_hierarchy(hierarchy_t *h) {
+    for(int i = 1; i < h->num_levels; i++) {
+        if(h->levels[i].b < h->levels[i - 1].b ||
+           (h->inclusion == INCLUSION_EXCLUSIVE && h->levels[i].b != h->levels[i - 1].b)) {
+            return -1;
+        }
+    }
+    for(int i = 0; i < h->num_levels; i++) {
+        level_t *level = &h->levels[i];
+        cache_init(&level->cache, level->s, level->E, level->b, level->policy);
+    }
+    return 0;
+}
+
+/*
+ * free_hierarchy:
+ * Frees the caches of every level.
+ */
+void free_hierarchy(hierarchy_t *h) {
+    for(int i = 0; i < h->num_levels; i++) {
+        cache_free(&h->levels[i].cache);
+    }
+}
+
+void level_write_back(hierarchy_t *h, int i, mem_addr_t addr);
+
+/*
+ * back_invalidate:
+ * Drops every block of the levels above level i that lies in the block of
+ * level i at 'addr'. Returns 1 if any of them was dirty.
+ */
+int back_invalidate(hierarchy_t *h, int i, mem_addr_t addr) {
+    mem_addr_t end = addr + (1ULL << h->levels[i].b);
+    int dirty = 0;
+
+    for(int k = 0; k < i; k++) {
+        cache_t *c = &h->levels[k].cache;
+        for(mem_addr_t sub = addr; sub < end; sub += 1ULL << c->b) {
+            int wasDirty;
+            if(cache_invalidate(c, sub, &wasDirty)) {
+                h->levels[i].back_invalidations++;
+                dirty |= wasDirty;
+            }
+        }
+    }
+    return dirty;
+}
+
+/*
+ * level_fill:
+ * Puts the block of 'addr' into level i and deals with the block it
+ * evicts: an inclusive hierarchy drops it from the levels above and a
+ * dirty one is written back to the level below.
+ */
+void level_fill(hierarchy_t *h, int i, int setNum, mem_addr_t addr, int dirty) {
+    cache_t *c = &h->levels[i].cache;
+    victim_t victim;
+
+    if(cache_fill(c, setNum, addr, dirty, &victim) != ACCESS_EVICT) {
+        return;
+    }
+    c->evictions++;
+    if(h->inclusion == INCLUSION_INCLUSIVE) {
+        victim.dirty |= back_invalidate(h, i, victim.addr);
+    }
+    if(victim.dirty) {
+        h->levels[i].writebacks++;
+        level_write_back(h, i + 1, victim.addr);
+    }
+}
+
+/*
+ * level_write_back:
+ * Writes a dirty block back into level i, allocating it there if it is not
+ * cached (which inclusion rules out), or into memory below the last level.
+ */
+void level_write_back(hierarchy_t *h, int i, mem_addr_t addr) {
+    if(i == h->num_levels) {
+        h->mem_writes++;
+        return;
+    }
+
+    cache_t *c = &h->levels[i].cache;
+    int setNum = cache_set(c, addr);
+    int line = cache_find(c, setNum, addr);
+    if(line >= 0) {
+        cache_set_dirty(c, setNum, line);
+    } else {
+        level_fill(h, i, setNum, addr, 1);
+    }
+}
+
+/*
+ * level_access:
+ * Looks 'addr' up in level i and below of a nine or inclusive hierarchy,
+ * filling every level that missed on the way back up. Returns the cycles
+ * it took.
+ */
+long long level_access(hierarchy_t *h, int i, mem_addr_t addr, int write) {
+    if(i == h->num_levels) {
+        h->mem_reads++;
+        return h->mem_latency;
+    }
+
+    level_t *level = &h->levels[i];
+    cache_t *c = &level->cache;
+    int setNum = cache_set(c, addr);
+    int line = cache_find(c, setNum, addr);
+    if(line >= 0) {
+        c->policy->hit(c, setNum, line);
+        c->hits++;
+        if(write) {
+            cache_set_dirty(c, setNum, line);
+        }
+        return level->latency;
+    }
+    c->misses++;
+
+    long long cycles = level->latency + level_access(h, i + 1, addr, 0);
+    level_fill(h, i, setNum, addr, write);
+    return cycles;
+}
+
+/*
+ * exclusive_access:
+ * Looks 'addr' up in an exclusive hierarchy. A block found below L1 is
+ * moved up to L1 and the victims of every level move one level down.
+ * Returns the cycles it took.
+ */
+long long exclusive_access(hierarchy_t *h, mem_addr_t addr, int write) {
+    long long cycles = 0;
+    victim_t victim = {addr, write};
+    int i;
+
+    for(i = 0; i < h->num_levels; i++) {
+        cache_t *c = &h->levels[i].cache;
+        int setNum = cache_set(c, addr);
+        int line = cache_find(c, setNum, addr);
+        cycles += h->levels[i].latency;
+        if(line >= 0) {
+            int wasDirty;
+            c->hits++;
+            if(i == 0) {
+                c->policy->hit(c, setNum, line);
+                if(write) {
+                    cache_set_dirty(c, setNum, line);
+                }
+                return cycles;
+            }
+            cache_invalidate(c, addr, &wasDirty);
+            victim.dirty |= wasDirty;
+            break;
+        }
+        c->misses++;
+    }
+    if(i == h->num_levels) {
+        h->mem_reads++;
+        cycles += h->mem_latency;
+    }
+
+    //the block goes into L1 and what a level evicts into the one below
+    for(i = 0; i < h->num_levels; i++) {
+        cache_t *c = &h->levels[i].cache;
+        if(cache_fill(c, cache_set(c, victim.addr), victim.addr, victim.dirty, &victim) != ACCESS_EVICT) {
+            return cycles;
+        }
+        c->evictions++;
+        if(i + 1 < h->num_levels || victim.dirty) {
+            h->levels[i].writebacks++;
+        }
+    }
+    if(victim.dirty) {
+        h->mem_writes++;
+    }
+    return cycles;
+}
+
+/*
+ * hierarchy_access:
+ * Sends one access through the hierarchy and returns what happened in L1.
+ */
+access_t hierarchy_access(hierarchy_t *h, mem_addr_t addr, int write) {
+    cache_t *l1 = &h->levels[0].cache;
+    long long hits = l1->hits;
+    long long evictions = l1->evictions;
+
+    h->accesses++;
+    if(h->inclusion == INCLUSION_EXCLUSIVE) {
+        h->cycles += exclusive_access(h, addr, write);
+    } else {
+        h->cycles += level_access(h, 0, addr, write);
+    }
+
+    if(l1->hits > hits) {
+        return ACCESS_HIT;
+    }
+    return l1->evictions > evictions ? ACCESS_EVICT : ACCESS_MISS;
+}
+
+/*
+ * print_hierarchy:
+ * Prints the counts of every level, the memory traffic and the average
+ * memory access time.
+ */
+void print_hierarchy(hierarchy_t *h) {
+    const char *inclusion[] = {"nine", "inclusive", "exclusive"};
+
+    printf("%-5s %-12s %-7s %12s %12s %12s %12s %14s %10s\n", "level", "s,E,b", "policy", "hits", "misses",
+           "evictions", "writebacks", "wb bytes", "miss rate");
+    for(int i = 0; i < h->num_levels; i++) {
+        level_t *level = &h->levels[i];
+        cache_t *c = &level->cache;
+        long long lookups = c->hits + c->misses;
+        char geometry[40];
+        snprintf(geometry, sizeof(geometry), "%d,%d,%d", level->s, level->E, level->b);
+        printf("L%-4d %-12s %-7s %12lld %12lld %12lld %12lld %14lld %9.2f%%\n", i + 1, geometry, level->policy->name,
+               c->hits, c->misses, c->evictions, level->writebacks, level->writebacks << level->b,
+               lookups > 0 ? 100.0 * c->misses / lookups : 0.0);
+    }
+    if(h->inclusion == INCLUSION_INCLUSIVE) {
+        for(int i = 1; i < h->num_levels; i++) {
+            printf("L%d back-invalidations: %lld\n", i + 1, h->levels[i].back_invalidations);
+        }
+    }
+    printf("memory: %lld reads, %lld writes (%lld bytes written), %s hierarchy\n", h->mem_reads, h->mem_writes,
+           h->mem_writes << h->levels[h->num_levels - 1].b, inclusion[h->inclusion]);
+    printf("AMAT: %.2f cycles\n", h->accesses > 0 ? (double)h->cycles / h->accesses : 0.0);
+}
+
+
+/* 
+ * access_data:
+ * Simulates data access at given "addr" memory address in the cache.
+ *
+ * If already in cache, increment hit_cnt
+ * If not in cache, cache it (set tag), increment miss_cnt
+ * If a line is evicted, increment evict_cnt
+ *
+ * 'write' is set for a store of 'len' bytes. With -L the access goes
+ * through the hierarchy and the counts are those of L1.
+ */                    
+void access_data(mem_addr_t addr, unsigned int len, int write) {
+    access_t result;
+
+    if(hierarchy.num_levels > 0) {
+        result = hierarchy_access(&hierarchy, addr, write);
+    } else if(write) {
+        result = cache_store(&cache, addr, len);
+    } else {
+        result = cache_access(&cache, addr);
+    }
+
+    switch(result) {
+        case ACCESS_HIT:
+            hit_cnt += 1;
+            break;
+        case ACCESS_EVICT:
+            evict_cnt += 1;
+            miss_cnt += 1;
+            break;
+        case ACCESS_MISS:
+            miss_cnt += 1;
+            break;
+    }
+}
+  
+  
+//Type trace_visitor_t: called by read_trace for every L, S and M record.
+typedef void (*trace_visitor_t)(char op, mem_addr_t addr, unsigned int len, void *ctx);
+
+//Bytes read at a time from traces that cannot be mapped (pipes, stdin).
+#define TRACE_CHUNK (1 << 20)
+
+//Value of every hex digit character, -1 for all other characters.
+const signed char hex_value[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+};
+
+/*
+ * hex_digit:
+ * Returns the value of hex digit 'ch', -1 if it is not one.
+ */
+int hex_digit(unsigned char ch) {
+    return hex_value[ch];
+}
+
+/*
+ * parse_lines:
+ * Parses the lines in [p, end) in one pass and calls 'visit' for every L, S
+ * and M record, the same lines the old fgets/sscanf("%llx,%u") reader took:
+ * the type is the second character and the hex address starts after it.
+ * The last line must end with a newline. A newline stops every scan below,
+ * so they never need to check for 'end'.
+ */
+void parse_lines(const char *p, const char *end, trace_visitor_t visit, void *ctx) {
+    while(p < end) {
+        const char *q = p;
+
+        if(p[0] != '\n' && (p[1] == 'S' || p[1] == 'L' || p[1] == 'M') && p[2] != '\n') {
+            mem_addr_t addr = 0;
+            unsigned int len = 0;
+            int digit;
+
+            q = p + 3;
+            while(*q == ' ' || *q == '\t') {
+                q++;
+            }
+            if(q[0] == '0' && (q[1] | 0x20) == 'x' && hex_digit(q[2]) >= 0) {
+                q += 2;
+            }
+            if(hex_digit(*q) >= 0) {
+                while((digit = hex_digit(*q)) >= 0) {
+                    addr = addr << 4 | digit;
+                    q++;
+                }
+                if(*q == ',') {
+                    q++;
+                    while(*q == ' ' || *q == '\t') {
+                        q++;
+                    }
+                    while((unsigned)(*q - '0') < 10) {
+                        len = len * 10 + (*q - '0');
+                        q++;
+                    }
+                }
+                visit(p[1], addr, len, ctx);
+            }
+        }
+
+        //on to the next line, a well formed record stops right at its newline
+        if(*q != '\n') {
+            q = memchr(q, '\n', end - q);
+        }
+        p = q + 1;
+    }
+}
+
+/*
+ * parse_trace:
+ * Parses the trace in [p, end), the last line may lack its newline.
+ */
+void parse_trace(const char *p, const char *end, trace_visitor_t visit, void *ctx) {
+    const char *last = end; //start of a last line without newline
+    char buf[1000];
+
+    while(last > p && last[-1] != '\n') {
+        last--;
+    }
+    parse_lines(p, last, visit, ctx);
+
+    if(last < end) { //copy it out and end it with a newline
+        size_t len = end - last < (long)sizeof(buf) - 1 ? (size_t)(end - last) : sizeof(buf) - 1;
+        memcpy(buf, last, len);
+        buf[len] = '\n';
+        parse_lines(buf, buf + len + 1, visit, ctx);
+    }
+}
+
+//Split every access into one per block it touches, set by -B.
+int split_blocks = 0;
+
+//Type split_t: where split_access sends the pieces of an access.
+typedef struct split {
+    trace_visitor_t visit;
+    void *ctx;
+    int b;                     //block bits to split at
+} split_t;
+
+/*
+ * split_access:
+ * Trace visitor that passes an access on as one access per 2^b byte block
+ * of [addr, addr+len), each with the bytes that lie in that block.
+ */
+void split_access(char op, mem_addr_t addr, unsigned int len, void *ctx) {
+    split_t *split = ctx;
+    mem_addr_t end = addr + len;
+
+    if(len <= 1 || end < addr) { //nothing to split, or it wraps around
+        split->visit(op, addr, len, split->ctx);
+        return;
+    }
+    for(;;) {
+        mem_addr_t next = ((addr >> split->b) + 1) << split->b;
+        if(next >= end || next == 0) {
+            split->visit(op, addr, end - addr, split->ctx);
+            return;
+        }
+        split->visit(op, addr, next - addr, split->ctx);
+        addr = next;
+    }
+}
+
+void read_trace(char* trace_fn, trace_visitor_t visit, void *ctx);
+
+/*
+ * read_trace_blocks:
+ * Like read_trace, but with -B every access is split at the boundaries of
+ * the 2^blockBits byte blocks of the cache first.
+ */
+void read_trace_blocks(char* trace_fn, int blockBits, trace_visitor_t visit, void *ctx) {
+    split_t split = {visit, ctx, blockBits};
+
+    if(split_blocks) {
+        read_trace(trace_fn, split_access, &split);
+    } else {
+        read_trace(trace_fn, visit, ctx);
+    }
+}
+
+/* 
+ * read_trace:
+ * Reads the input trace file and calls 'visit' with the type (L/S/M),
+ * address and size of each memory access. Regular files are mapped and
+ * parsed in place, anything else (a pipe, or stdin when the name is "-")
+ * is read in chunks.
+ */                    
+void read_trace(char* trace_fn, trace_visitor_t visit, void *ctx) {           
+    int fd = strcmp(trace_fn, "-") == 0 ? STDIN_FILENO : open(trace_fn, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0) { 
+        fprintf(stderr, "%s: %s\n", trace_fn, strerror(errno));
+        exit(1);   
+    }
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            parse_trace(map, map + st.st_size, visit, ctx);
+            munmap(map, st.st_size);
+            if (fd != STDIN_FILENO)
+                close(fd);
+            return;
+        }
+    }
+
+    //can't map it, stream it and carry the incomplete last line over to the next chunk
+    char *buf = malloc(TRACE_CHUNK);
+    size_t have = 0;
+    if (buf == NULL) {
         exit(1);
     }
-     
-    //allocate space the every line in the cache
-    for(int i = 0; i < S; i++) {
-        cache[i] = malloc(sizeof(cache_line_t) * E);
-        if(cache[i] == NULL) { //check that it was allocated correctly
+    for (;;) {
+        ssize_t got = read(fd, buf + have, TRACE_CHUNK - have);
+        if (got < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "%s: %s\n", trace_fn, strerror(errno));
             exit(1);
         }
-        //set each value from the struct 
-        for(int u = 0; u < E; u++) {
-            cache[i][u].valid = '0';
-            cache[i][u].tag = 0;
-            cache[i][u].lruCounter = 0;
+        if (got == 0)
+            break;
+        have += got;
+
+        size_t keep = 0; //bytes after the last newline
+        while (keep < have && buf[have - 1 - keep] != '\n')
+            keep++;
+        if (keep == have) {
+            if (have < TRACE_CHUNK)
+                continue;
+            keep = 0; //one line fills the whole buffer, take it as it is
         }
-    }      
-}
-  
+        parse_trace(buf, buf + have - keep, visit, ctx);
+        memmove(buf, buf + have - keep, keep);
+        have = keep;
+    }
+    parse_trace(buf, buf + have, visit, ctx);
+    free(buf);
+    if (fd != STDIN_FILENO)
+        close(fd);
+}  
 
-/* 
- * free_cache:
- * Frees all heap allocated memory used by the cache.
- */                    
-void free_cache() {
-    //for loop to iterate through cache and free every line and then free the cache itself
-    for(int r = 0; r < S; r++) {
-        free(cache[r]);
-        cache[r] = NULL;
-    }    
-    free(cache);
-    cache = NULL;         
+
+/*
+ * replay_access:
+ * Replays one access of the trace against the cache, M is a load followed
+ * by a store to the same address.
+ */
+void replay_access(char op, mem_addr_t addr, unsigned int len, void *ctx) {
+    (void)ctx;
+    if (verbosity)
+        printf("%c %llx,%u ", op, addr, len);
+
+    if(op == 'S' || op == 'L') {
+        access_data(addr, len, op == 'S');
+    } 
+    
+    if(op == 'M') {
+        access_data(addr, len, 0);
+        access_data(addr, len, 1);
+    }
+
+    if (verbosity)
+        printf("\n");
 }
 
 
 /* 
- * access_data:
- * Simulates data access at given "addr" memory address in the cache.
- *
- * If already in cache, increment hit_cnt
- * If not in cache, cache it (set tag), increment miss_cnt
- * If a line is evicted, increment evict_cnt
+ * replay_trace:
+ * Replays the given trace file against the cache.
  */                    
-void access_data(mem_addr_t addr) {
-    //local variables to help stop the function from incrementing miss_cnt and evict_cnt when it shouldn't
-    int hitTracker = 0;
-    int evictTracker = 0;
-    
-    //masks used to find the s and t bits
-    mem_addr_t setMask = ((1 << s) - 1);
-    mem_addr_t tMask = ((1 << (64 - s - b)) - 1);
+void replay_trace(char* trace_fn) {           
+    read_trace_blocks(trace_fn, hierarchy.num_levels > 0 ? hierarchy.levels[0].b : b, replay_access, NULL);
+}  
 
-    //find the s and t bits using the masks and &
-    int setNum = (addr >> b) & setMask;
-    int tNum = (addr >> (b + s)) & tMask;
-    
-    //look through cache to find if its already in the cache
-    for(int t = 0; t < E; t++) {
-        if(cache[setNum][t].tag == tNum && cache[setNum][t].valid == '1') {
-            hit_cnt += 1; //it is in the cache so increment the global variable
-            cache[setNum][t].lruCounter = currMax + 1;
-            currMax += 1;
-            hitTracker = 1; //used to stop the function from incrementing miss_cnt
-            break;
+
+/*
+ * A trace held in memory, for policies that need to look ahead and for
+ * replaying the same trace more than once.
+ */
+typedef struct trace_rec {
+    mem_addr_t addr;
+    unsigned int len;
+    char op;
+} trace_rec_t;
+
+typedef struct trace {
+    trace_rec_t *recs;
+    long long num_recs;
+    long long cap_recs;
+    long long num_accesses; //M records count twice
+} trace_t;
+
+void load_access(char op, mem_addr_t addr, unsigned int len, void *ctx) {
+    trace_t *trace = ctx;
+
+    if(trace->num_recs == trace->cap_recs) {
+        trace->cap_recs = trace->cap_recs ? trace->cap_recs * 2 : 4096;
+        trace->recs = realloc(trace->recs, sizeof(trace_rec_t) * trace->cap_recs);
+        if(trace->recs == NULL) {
+            exit(1);
         }
     }
+    trace->recs[trace->num_recs].addr = addr;
+    trace->recs[trace->num_recs].len = len;
+    trace->recs[trace->num_recs].op = op;
+    trace->num_recs++;
+    trace->num_accesses += op == 'M' ? 2 : 1;
+}
 
-    if(!hitTracker) {
-        //was not in cache so increment miss_cnt by 1
-        miss_cnt += 1;
+/*
+ * load_trace:
+ * Reads the whole trace file into 'trace', split at the blocks of the
+ * cache with -B.
+ */
+void load_trace(char* trace_fn, trace_t *trace) {
+    memset(trace, 0, sizeof(trace_t));
+    read_trace_blocks(trace_fn, b, load_access, trace);
+}
 
-        //iterate through entire set looking for a valid bit of 0
-        for(int tag = 0; tag < E; tag++) {
-            if(cache[setNum][tag].valid == '0') { 
-                cache[setNum][tag].valid = '1';//set the valid bit to 1
-                cache[setNum][tag].tag = tNum; //set the line's tag to tNum
-                cache[setNum][tag].lruCounter = currMax + 1; //set this line to the most recently used 
-                currMax += 1;
-                evictTracker = 1; //to stop the function from incrementing evict_cnt
-                break;
-            }
-        }
+/*
+ * Type block_map_t: open addressing hash table from block number to a
+ * long long, for the passes that have to find the last access to a block.
+ */
+typedef struct block_map {
+    size_t cap;
+    size_t used;
+    mem_addr_t *keys;    //block + 1, 0 marks an empty slot
+    long long *vals;
+} block_map_t;
 
-        if(!evictTracker) {
-            //no free space in cache, have to evict so update evict_cnt by 1
-            evict_cnt += 1;
+void block_map_init(block_map_t *map) {
+    map->cap = 1024;
+    map->used = 0;
+    map->keys = calloc(map->cap, sizeof(mem_addr_t));
+    map->vals = malloc(sizeof(long long) * map->cap);
+    if(map->keys == NULL || map->vals == NULL) {
+        exit(1);
+    }
+}
+
+void block_map_free(block_map_t *map) {
+    free(map->keys);
+    free(map->vals);
+}
 
-            //local variables used to keep track of the least recently used line
-            int leastUsed = 900000;
-            int currIndexLRU = 0; 
-            int lruIndex = 0;
+/*
+ * block_map_get:
+ * Returns the value of 'block', adding it with value 'init' if it is not
+ * in the map yet. The pointer is good until the next block_map_get.
+ */
+long long* block_map_get(block_map_t *map, mem_addr_t block, long long init) {
+    mem_addr_t key = block + 1;
+    size_t slot = (key * 0x9e3779b97f4a7c15ULL) & (map->cap - 1);
 
-            //iterate through the entire set looking for the least recently used line that will be evicted
-            for(int y = 0; y < E; y++) {
-                currIndexLRU = cache[setNum][y].lruCounter;
+    while(map->keys[slot] != 0 && map->keys[slot] != key) {
+        slot = (slot + 1) & (map->cap - 1);
+    }
+    if(map->keys[slot] == key) {
+        return &map->vals[slot];
+    }
 
-                //current line is the current least recently used line
-                if(currIndexLRU < leastUsed) {
-                    leastUsed = currIndexLRU;
-                    lruIndex = y;
-                }   
+    if(2 * (map->used + 1) > map->cap) { //grow the table and look again
+        block_map_t old = *map;
+        map->cap *= 2;
+        map->keys = calloc(map->cap, sizeof(mem_addr_t));
+        map->vals = malloc(sizeof(long long) * map->cap);
+        if(map->keys == NULL || map->vals == NULL) {
+            exit(1);
+        }
+        for(size_t i = 0; i < old.cap; i++) {
+            if(old.keys[i] != 0) {
+                slot = (old.keys[i] * 0x9e3779b97f4a7c15ULL) & (map->cap - 1);
+                while(map->keys[slot] != 0) {
+                    slot = (slot + 1) & (map->cap - 1);
+                }
+                map->keys[slot] = old.keys[i];
+                map->vals[slot] = old.vals[i];
             }
+        }
+        block_map_free(&old);
+        slot = (key * 0x9e3779b97f4a7c15ULL) & (map->cap - 1);
+        while(map->keys[slot] != 0) {
+            slot = (slot + 1) & (map->cap - 1);
+        }
+    }
+    map->keys[slot] = key;
+    map->vals[slot] = init;
+    map->used++;
+    return &map->vals[slot];
+}
 
-            //set the least recently used line to the current tag and set its counter to the most recently used
-            cache[setNum][lruIndex].valid = '1';
-            cache[setNum][lruIndex].tag = tNum;
-            cache[setNum][lruIndex].lruCounter = currMax + 1;
-            currMax += 1;
+/*
+ * build_next_use:
+ * Returns for every access of 'trace' the index of the next access to the
+ * same 2^b byte block, LLONG_MAX if there is none. The trace is walked
+ * backwards remembering the last index seen for every block.
+ */
+long long* build_next_use(trace_t *trace, int b) {
+    long long *next = malloc(sizeof(long long) * (trace->num_accesses > 0 ? trace->num_accesses : 1));
+    long long k = trace->num_accesses;
+    block_map_t last;
+
+    if(next == NULL) {
+        exit(1);
+    }
+    block_map_init(&last);
+    for(long long r = trace->num_recs - 1; r >= 0; r--) {
+        long long *lastUse = block_map_get(&last, trace->recs[r].addr >> b, LLONG_MAX);
+        for(int rep = trace->recs[r].op == 'M' ? 2 : 1; rep > 0; rep--) {
+            next[--k] = *lastUse;
+            *lastUse = k;
         }
     }
+    block_map_free(&last);
+    return next;
 }
-  
-  
-/* 
- * replay_trace:
- * Replays the given trace file against the cache.
- *
- * Reads the input trace file line by line.
- * Extracts the type of each memory access : L/S/M
- */                    
-void replay_trace(char* trace_fn) {           
-    char buf[1000];  
-    mem_addr_t addr = 0;
-    unsigned int len = 0;
-    FILE* trace_fp = fopen(trace_fn, "r"); 
 
-    if (!trace_fp) { 
-        fprintf(stderr, "%s: %s\n", trace_fn, strerror(errno));
-        exit(1);   
+/*
+ * replay_loaded:
+ * Replays a trace held in memory against the cache.
+ */
+void replay_loaded(trace_t *trace) {
+    for(long long r = 0; r < trace->num_recs; r++) {
+        replay_access(trace->recs[r].op, trace->recs[r].addr, trace->recs[r].len, NULL);
     }
+}
 
-    while (fgets(buf, 1000, trace_fp) != NULL) {
-        if (buf[1] == 'S' || buf[1] == 'L' || buf[1] == 'M') {
-            sscanf(buf+3, "%llx,%u", &addr, &len);
-      
-            if (verbosity)
-                printf("%c %llx,%u ", buf[1], addr, len);
-
-            if(buf[1] == 'S' || buf[1] == 'L') {
-                access_data(addr);
-            } 
-            
-            if(buf[1] == 'M') {
-                access_data(addr);
-                access_data(addr);
-            }
 
-            if (verbosity)
-                printf("\n");
-        }
-    }
-    fclose(trace_fp);
-}  
-  
-  
 /*
  * print_usage:
  * Print information on how to use csim to standard output.
  */                    
 void print_usage(char* argv[]) {                 
-    printf("Usage: %s [-hv] -s <num> -E <num> -b <num> -t <file>\n", argv[0]);
+    printf("Usage: %s [-hv] -s <num> -E <num> -b <num> [-p <policy>] -t <file>\n", argv[0]);
     printf("Options:\n");
     printf("  -h         Print this help message.\n");
     printf("  -v         Optional verbose flag.\n");
     printf("  -s <num>   Number of s bits for set index.\n");
     printf("  -E <num>   Number of lines per set.\n");
     printf("  -b <num>   Number of b bits for block offsets.\n");
-    printf("  -t <file>  Trace file.\n");
+    printf("  -p <policy> Replacement policy: lru (default), fifo, random, plru, lfu,\n");
+    printf("             srrip, brrip, opt, or all to compare them against opt.\n");
+    printf("  -t <file>  Trace file, - reads it from stdin.\n");
+    printf("  -f <fmt>   Table format of a sweep: csv (default) or json.\n");
+    printf("  -j <num>   Threads of a sweep, one per CPU by default.\n");
+    printf("  -m         LRU miss ratio curve over the range of -E from stack distances,\n");
+    printf("             followed by a fully associative one of the same sizes.\n");
+    printf("  -L <level> Add a level to a cache hierarchy, s,E,b[,policy[,latency]],\n");
+    printf("             L1 first. Replaces -s, -E and -b.\n");
+    printf("  -I <mode>  Inclusion of the hierarchy: nine (default), inclusive or exclusive.\n");
+    printf("  -M <num>   Memory latency of the hierarchy in cycles, %d by default.\n", DEFAULT_MEM_LATENCY);
+    printf("  -w <mode>  Write policy of a single cache: back (default) or through.\n");
+    printf("  -a <mode>  On a store miss: allocate (default) or no-allocate.\n");
+    printf("             -w, -a and -v add a line with the bytes written to memory.\n");
+    printf("  -B         Split accesses into one per block of [addr, addr+len).\n");
+    printf("\n-s, -E and -b take a range lo-hi or lo-hi:step to sweep over every\n");
+    printf("configuration in it, -p all adds the policy to the sweep.\n");
     printf("\nExamples:\n");
     printf("  linux>  %s -s 4 -E 1 -b 4 -t traces/yi.trace\n", argv[0]);
     printf("  linux>  %s -v -s 8 -E 2 -b 4 -t traces/yi.trace\n", argv[0]);
+    printf("  linux>  %s -s 4 -E 4 -b 4 -p all -t traces/yi.trace\n", argv[0]);
+    printf("  linux>  %s -s 0-8 -E 1-16 -b 4-6 -f json -t traces/yi.trace\n", argv[0]);
+    printf("  linux>  %s -m -s 4 -E 1-64 -b 4 -t traces/yi.trace\n", argv[0]);
+    printf("  linux>  %s -L 6,8,6 -L 10,16,6,srrip -I inclusive -t traces/yi.trace\n", argv[0]);
+    printf("  linux>  %s -s 4 -E 2 -b 4 -w through -a no-allocate -t traces/yi.trace\n", argv[0]);
     exit(0);
 }  
   
@@ -251,15 +1523,485 @@ void print_usage(char* argv[]) {
  * print_summary:
  * Prints a summary of the cache simulation statistics to a file.
  */                    
-void print_summary(int hits, int misses, int evictions) {                
-    printf("hits:%d misses:%d evictions:%d\n", hits, misses, evictions);
+void print_summary(long long hits, long long misses, long long evictions) {                
+    printf("hits:%lld misses:%lld evictions:%lld\n", hits, misses, evictions);
     FILE* output_fp = fopen(".csim_results", "w");
     assert(output_fp);
-    fprintf(output_fp, "%d %d %d\n", hits, misses, evictions);
+    fprintf(output_fp, "%lld %lld %lld\n", hits, misses, evictions);
     fclose(output_fp);
 }  
+
+
+/*
+ * print_write_summary:
+ * Prints the memory writes of cache 'c' on a line of their own after the
+ * summary, lines written back by cache_flush included. Only called when
+ * -w, -a or -v is given so the default output stays one line.
+ */
+void print_write_summary(cache_t *c) {
+    printf("dirty_evictions:%lld dirty_flushed:%lld bytes_written:%lld\n",
+           c->dirty_evictions, c->dirty_flushed, c->bytes_written);
+}  
   
   
+/*
+ * compare_policies:
+ * Replays the trace once per replacement policy and prints how many more
+ * misses each one has than opt. The summary is the one of LRU.
+ */
+void compare_policies(char *trace_fn) {
+    trace_t trace;
+    long long *nextUse;
+    long long hits[NUM_POLICIES];
+    long long misses[NUM_POLICIES];
+    long long evictions[NUM_POLICIES];
+
+    load_trace(trace_fn, &trace);
+    nextUse = build_next_use(&trace, b);
+
+    for(int p = 0; p < NUM_POLICIES; p++) {
+        replacement = &policies[p];
+        hit_cnt = miss_cnt = evict_cnt = 0;
+        init_cache();
+        cache.nextUse = nextUse;
+        replay_loaded(&trace);
+        free_cache();
+        hits[p] = hit_cnt;
+        misses[p] = miss_cnt;
+        evictions[p] = evict_cnt;
+    }
+
+    printf("%-8s %12s %12s %12s %10s %14s\n", "policy", "hits", "misses", "evictions", "miss rate", "misses vs opt");
+    for(int p = 0; p < NUM_POLICIES; p++) {
+        long long total = hits[p] + misses[p];
+        long long extra = misses[p] - misses[POLICY_OPT];
+        printf("%-8s %12lld %12lld %12lld %9.2f%% %+14lld", policies[p].name, hits[p], misses[p], evictions[p],
+               total > 0 ? 100.0 * misses[p] / total : 0.0, extra);
+        if(misses[POLICY_OPT] > 0) {
+            printf(" (%+.1f%%)", 100.0 * extra / misses[POLICY_OPT]);
+        }
+        printf("\n");
+    }
+    print_summary(hits[0], misses[0], evictions[0]);
+
+    free(nextUse);
+    free(trace.recs);
+}
+
+
+/*
+ * A sweep: every combination of s, E, b (and policy with -p all) in the
+ * ranges given on the command line, simulated over one decoded copy of
+ * the trace. Workers take the next configuration until none are left.
+ */
+typedef struct range {
+    int lo, hi, step;
+} range_t;
+
+typedef struct sweep_config {
+    int s, E, b;
+    const policy_t *policy;
+    long long hits, misses, evictions;
+} sweep_config_t;
+
+typedef struct sweep {
+    const mem_addr_t *addrs;     //every access of the trace, M twice
+    long long num_accesses;
+    long long *nextUse[64];      //opt only, next use index for every b in the sweep
+    sweep_config_t *configs;
+    int num_configs;
+    int next_config;             //next one to simulate, taken under lock
+    pthread_mutex_t lock;
+} sweep_t;
+
+/*
+ * parse_range:
+ * Parses "n", "lo-hi" or "lo-hi:step" into 'range'. Returns 0 on
+ * success, -1 if 'arg' is not a range of values >= min.
+ */
+int parse_range(const char *arg, range_t *range, int min) {
+    char *rest;
+
+    range->lo = strtol(arg, &rest, 10);
+    range->hi = range->lo;
+    range->step = 1;
+    if(rest == arg) {
+        return -1;
+    }
+    if(*rest == '-') {
+        arg = rest + 1;
+        range->hi = strtol(arg, &rest, 10);
+        if(rest == arg) {
+            return -1;
+        }
+    }
+    if(*rest == ':') {
+        arg = rest + 1;
+        range->step = strtol(arg, &rest, 10);
+        if(rest == arg) {
+            return -1;
+        }
+    }
+    if(*rest != '\0' || range->lo < min || range->hi < range->lo || range->step < 1) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * decode_accesses:
+ * Returns the address of every access of 'trace' in order, M twice.
+ */
+mem_addr_t* decode_accesses(trace_t *trace) {
+    mem_addr_t *addrs = malloc(sizeof(mem_addr_t) * (trace->num_accesses > 0 ? trace->num_accesses : 1));
+    long long k = 0;
+
+    if(addrs == NULL) {
+        exit(1);
+    }
+    for(long long r = 0; r < trace->num_recs; r++) {
+        addrs[k++] = trace->recs[r].addr;
+        if(trace->recs[r].op == 'M') {
+            addrs[k++] = trace->recs[r].addr;
+        }
+    }
+    return addrs;
+}
+
+/*
+ * print_sweep_table:
+ * Prints the results of 'count' configurations as a CSV table or, if
+ * 'json' is set, a JSON array.
+ */
+void print_sweep_table(sweep_config_t *configs, int count, int json) {
+    if(json) {
+        printf("[\n");
+    } else {
+        printf("s,E,b,policy,hits,misses,evictions,miss_rate\n");
+    }
+    for(int i = 0; i < count; i++) {
+        sweep_config_t *config = &configs[i];
+        long long total = config->hits + config->misses;
+        double rate = total > 0 ? (double)config->misses / total : 0.0;
+        if(json) {
+            printf("  {\"s\": %d, \"E\": %d, \"b\": %d, \"policy\": \"%s\", \"hits\": %lld, \"misses\": %lld, "
+                   "\"evictions\": %lld, \"miss_rate\": %.6f}%s\n", config->s, config->E, config->b,
+                   config->policy->name, config->hits, config->misses, config->evictions, rate,
+                   i + 1 < count ? "," : "");
+        } else {
+            printf("%d,%d,%d,%s,%lld,%lld,%lld,%.6f\n", config->s, config->E, config->b, config->policy->name,
+                   config->hits, config->misses, config->evictions, rate);
+        }
+    }
+    if(json) {
+        printf("]\n");
+    }
+}
+
+/*
+ * sweep_worker:
+ * Thread body of a sweep, simulates configurations until all are taken.
+ */
+void* sweep_worker(void *arg) {
+    sweep_t *sweep = arg;
+
+    for(;;) {
+        pthread_mutex_lock(&sweep->lock);
+        int i = sweep->next_config++;
+        pthread_mutex_unlock(&sweep->lock);
+        if(i >= sweep->num_configs) {
+            return NULL;
+        }
+
+        sweep_config_t *config = &sweep->configs[i];
+        cache_t c;
+        cache_init(&c, config->s, config->E, config->b, config->policy);
+        c.nextUse = sweep->nextUse[config->b];
+        for(long long k = 0; k < sweep->num_accesses; k++) {
+            cache_access(&c, sweep->addrs[k]);
+        }
+        config->hits = c.hits;
+        config->misses = c.misses;
+        config->evictions = c.evictions;
+        cache_free(&c);
+    }
+}
+
+/*
+ * run_sweep:
+ * Simulates every configuration in the ranges with 'policy', or every
+ * policy if it is NULL, on 'threads' threads and prints the results as a
+ * CSV table or, if 'json' is set, a JSON array.
+ */
+void run_sweep(char *trace_fn, range_t sr, range_t er, range_t br, const policy_t *policy, int threads, int json) {
+    sweep_t sweep;
+    trace_t trace;
+    int count = 0;
+
+    memset(&sweep, 0, sizeof(sweep_t));
+    for(int ss = sr.lo; ss <= sr.hi; ss += sr.step) {
+        for(int ee = er.lo; ee <= er.hi; ee += er.step) {
+            for(int bb = br.lo; bb <= br.hi; bb += br.step) {
+                count += policy ? 1 : NUM_POLICIES;
+            }
+        }
+    }
+    sweep.configs = calloc(count, sizeof(sweep_config_t));
+    if(sweep.configs == NULL) {
+        exit(1);
+    }
+    for(int ss = sr.lo; ss <= sr.hi; ss += sr.step) {
+        for(int ee = er.lo; ee <= er.hi; ee += er.step) {
+            for(int bb = br.lo; bb <= br.hi; bb += br.step) {
+                for(int p = 0; p < NUM_POLICIES; p++) {
+                    if(policy == NULL || policy == &policies[p]) {
+                        sweep_config_t *config = &sweep.configs[sweep.num_configs++];
+                        config->s = ss;
+                        config->E = ee;
+                        config->b = bb;
+                        config->policy = &policies[p];
+                    }
+                }
+            }
+        }
+    }
+
+    //parse the trace once, every configuration replays the same addresses
+    load_trace(trace_fn, &trace);
+    sweep.addrs = decode_accesses(&trace);
+    sweep.num_accesses = trace.num_accesses;
+    if(policy == NULL || policy == &policies[POLICY_OPT]) {
+        for(int bb = br.lo; bb <= br.hi; bb += br.step) {
+            sweep.nextUse[bb] = build_next_use(&trace, bb);
+        }
+    }
+    free(trace.recs);
+
+    select_find_tag();
+    pthread_mutex_init(&sweep.lock, NULL);
+    if(threads > sweep.num_configs) {
+        threads = sweep.num_configs;
+    }
+    pthread_t *workers = malloc(sizeof(pthread_t) * threads);
+    if(workers == NULL) {
+        exit(1);
+    }
+    for(int t = 0; t < threads; t++) {
+        if(pthread_create(&workers[t], NULL, sweep_worker, &sweep) != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+    for(int t = 0; t < threads; t++) {
+        pthread_join(workers[t], NULL);
+    }
+    pthread_mutex_destroy(&sweep.lock);
+
+    print_sweep_table(sweep.configs, sweep.num_configs, json);
+
+    for(int bb = 0; bb < 64; bb++) {
+        free(sweep.nextUse[bb]);
+    }
+    free(workers);
+    free((void*)sweep.addrs);
+    free(sweep.configs);
+}
+
+
+/*
+ * Mattson's stack distance engine. With LRU a set of E lines holds the E
+ * blocks of the set used most recently, so an access hits exactly when
+ * fewer than E other blocks of its set were used since the last access to
+ * its block (its stack distance). One pass that records the distance of
+ * every access gives the hits of every E at once, and the evictions
+ * follow from the number of blocks each set ever sees, as a set only
+ * evicts once all its lines are filled.
+ *
+ * The distance is counted with a Fenwick tree per set over the times of
+ * the accesses to the set, where the latest access to every block has its
+ * bit set: the distance is the number of bits between the previous access
+ * to the block and now.
+ */
+typedef struct stack_profile {
+    int max_depth;
+    long long *hist;        //hist[d]: reuses at distance d, d < max_depth
+    long long accesses;
+    long long *set_blocks;  //distinct blocks seen by every set
+} stack_profile_t;
+
+/*
+ * stack_distances:
+ * Fills 'profile' with the stack distances of 'addrs' in a cache of 2^s
+ * sets of 2^b byte blocks, distances of max_depth and more are not kept.
+ */
+void stack_distances(const mem_addr_t *addrs, long long count, int s, int b, int max_depth, stack_profile_t *profile) {
+    mem_addr_t mask = (1ULL << s) - 1;
+    long long *start = calloc(((size_t)1 << s) + 1, sizeof(long long)); //first slot of the tree of every set
+    long long *clock = calloc((size_t)1 << s, sizeof(long long));       //accesses to every set so far
+    unsigned int *tree = calloc(count > 0 ? count : 1, sizeof(unsigned int));
+    block_map_t last;
+
+    profile->max_depth = max_depth;
+    profile->hist = calloc(max_depth, sizeof(long long));
+    profile->set_blocks = calloc((size_t)1 << s, sizeof(long long));
+    profile->accesses = count;
+    if(start == NULL || clock == NULL || tree == NULL || profile->hist == NULL || profile->set_blocks == NULL) {
+        exit(1);
+    }
+
+    //the tree of a set has one slot per access to it
+    for(long long k = 0; k < count; k++) {
+        start[((addrs[k] >> b) & mask) + 1]++;
+    }
+    for(size_t set = 0; set < ((size_t)1 << s); set++) {
+        start[set + 1] += start[set];
+    }
+
+    block_map_init(&last);
+    for(long long k = 0; k < count; k++) {
+        mem_addr_t block = addrs[k] >> b;
+        size_t set = block & mask;
+        unsigned int *bits = tree + start[set] - 1; //trees count from 1
+        long long size = start[set + 1] - start[set];
+        long long now = ++clock[set];
+        long long *prev = block_map_get(&last, block, 0);
+
+        if(*prev == 0) {
+            profile->set_blocks[set]++;
+        } else {
+            long long distance = 0;
+            for(long long i = now - 1; i > 0; i -= i & -i) { //bits up to now - 1
+                distance += bits[i];
+            }
+            for(long long i = *prev; i > 0; i -= i & -i) {   //minus bits up to prev
+                distance -= bits[i];
+            }
+            if(distance < max_depth) {
+                profile->hist[distance]++;
+            }
+            for(long long i = *prev; i <= size; i += i & -i) {
+                bits[i]--;
+            }
+        }
+        for(long long i = now; i <= size; i += i & -i) {
+            bits[i]++;
+        }
+        *prev = now;
+    }
+    block_map_free(&last);
+    free(tree);
+    free(clock);
+    free(start);
+}
+
+/*
+ * profile_result:
+ * Fills in the hits, misses and evictions of LRU with E lines per set
+ * from a profile of the 2^s sets of 'config'.
+ */
+void profile_result(stack_profile_t *profile, sweep_config_t *config) {
+    long long fills = 0; //misses that found a free line
+
+    config->hits = 0;
+    for(int d = 0; d < config->E && d < profile->max_depth; d++) {
+        config->hits += profile->hist[d];
+    }
+    config->misses = profile->accesses - config->hits;
+    for(size_t set = 0; set < ((size_t)1 << config->s); set++) {
+        fills += profile->set_blocks[set] < config->E ? profile->set_blocks[set] : config->E;
+    }
+    config->evictions = config->misses - fills;
+    config->policy = &policies[0];
+}
+
+/*
+ * run_miss_curve:
+ * Prints the LRU miss ratio curve over every E in 'er' for every s and b
+ * in the ranges, followed by the curve of a fully associative cache over
+ * the same total numbers of lines, as a CSV table or JSON array. Each
+ * (s, b) takes one pass over the trace.
+ */
+void run_miss_curve(char *trace_fn, range_t sr, range_t er, range_t br, int json) {
+    trace_t trace;
+    mem_addr_t *addrs;
+    sweep_config_t *configs;
+    int *lines;     //sorted total numbers of lines of the fully associative curve
+    int num_lines = 0;
+    int count = 0;
+
+    for(int ss = sr.lo; ss <= sr.hi; ss += sr.step) {
+        for(int ee = er.lo; ee <= er.hi; ee += er.step) {
+            for(int bb = br.lo; bb <= br.hi; bb += br.step) {
+                count++;
+            }
+        }
+    }
+    lines = malloc(sizeof(int) * count);
+    configs = calloc(2 * count, sizeof(sweep_config_t));
+    if(lines == NULL || configs == NULL) {
+        exit(1);
+    }
+
+    //total lines that a fully associative cache needs to match every size, unless s = 0 already covers it
+    for(int ss = sr.lo; ss <= sr.hi; ss += sr.step) {
+        for(int ee = er.lo; ee <= er.hi; ee += er.step) {
+            long long total = (long long)ee << ss;
+            int i = num_lines;
+            if(total > INT_MAX || (sr.lo == 0 && total <= er.hi && (total - er.lo) % er.step == 0)) {
+                continue;
+            }
+            while(i > 0 && lines[i - 1] > total) {
+                i--;
+            }
+            if(i > 0 && lines[i - 1] == total) {
+                continue;
+            }
+            memmove(lines + i + 1, lines + i, sizeof(int) * (num_lines - i));
+            lines[i] = total;
+            num_lines++;
+        }
+    }
+
+    load_trace(trace_fn, &trace);
+    addrs = decode_accesses(&trace);
+
+    count = 0;
+    for(int ss = sr.lo; ss <= sr.hi; ss += sr.step) {
+        for(int bb = br.lo; bb <= br.hi; bb += br.step) {
+            stack_profile_t profile;
+            stack_distances(addrs, trace.num_accesses, ss, bb, er.hi, &profile);
+            for(int ee = er.lo; ee <= er.hi; ee += er.step) {
+                configs[count].s = ss;
+                configs[count].E = ee;
+                configs[count].b = bb;
+                profile_result(&profile, &configs[count++]);
+            }
+            free(profile.hist);
+            free(profile.set_blocks);
+        }
+    }
+    for(int bb = br.lo; bb <= br.hi && num_lines > 0; bb += br.step) {
+        stack_profile_t profile;
+        stack_distances(addrs, trace.num_accesses, 0, bb, lines[num_lines - 1], &profile);
+        for(int i = 0; i < num_lines; i++) {
+            configs[count].s = 0;
+            configs[count].E = lines[i];
+            configs[count].b = bb;
+            profile_result(&profile, &configs[count++]);
+        }
+        free(profile.hist);
+        free(profile.set_blocks);
+    }
+
+    print_sweep_table(configs, count, json);
+
+    free(lines);
+    free(configs);
+    free(addrs);
+    free(trace.recs);
+}
+
+
 /*
  * main:
  * Main parses command line args, makes the cache, replays the memory accesses
@@ -267,22 +2009,93 @@ void print_summary(int hits, int misses, int evictions) {
  */                    
 int main(int argc, char* argv[]) {                      
     char* trace_file = NULL;
+    char* policy_name = "lru";
+    char* format = NULL;
+    range_t s_range = {0, 0, 1}, E_range = {0, 0, 1}, b_range = {0, 0, 1};
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int miss_curve = 0;
+    int write_policy_set = 0;
+    int s_set = 0, b_set = 0;
     char c;
     
-    // Parse the command line arguments: -h, -v, -s, -E, -b, -t 
-    while ((c = getopt(argc, argv, "s:E:b:t:vh")) != -1) {
+    hierarchy.mem_latency = DEFAULT_MEM_LATENCY;
+
+    // Parse the command line arguments: -h, -v, -s, -E, -b, -p, -t, -f, -j, -m, -L, -I, -M, -w, -a, -B 
+    while ((c = getopt(argc, argv, "s:E:b:p:t:f:j:mL:I:M:w:a:Bvh")) != -1) {
         switch (c) {
+            case 'a':
+                if (strcmp(optarg, "allocate") == 0) {
+                    no_write_allocate = 0;
+                } else if (strcmp(optarg, "no-allocate") == 0) {
+                    no_write_allocate = 1;
+                } else {
+                    print_usage(argv);
+                    exit(1);
+                }
+                write_policy_set = 1;
+                break;
+            case 'B':
+                split_blocks = 1;
+                break;
             case 'b':
-                b = atoi(optarg);
+                if (parse_range(optarg, &b_range, 0) < 0) {
+                    print_usage(argv);
+                    exit(1);
+                }
+                b = b_range.lo;
+                b_set = 1;
                 break;
             case 'E':
-                E = atoi(optarg);
+                if (parse_range(optarg, &E_range, 1) < 0) {
+                    print_usage(argv);
+                    exit(1);
+                }
+                E = E_range.lo;
+                break;
+            case 'f':
+                format = optarg;
                 break;
             case 'h':
                 print_usage(argv);
                 exit(0);
+            case 'I':
+                if (strcmp(optarg, "nine") == 0) {
+                    hierarchy.inclusion = INCLUSION_NINE;
+                } else if (strcmp(optarg, "inclusive") == 0) {
+                    hierarchy.inclusion = INCLUSION_INCLUSIVE;
+                } else if (strcmp(optarg, "exclusive") == 0) {
+                    hierarchy.inclusion = INCLUSION_EXCLUSIVE;
+                } else {
+                    print_usage(argv);
+                    exit(1);
+                }
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'L':
+                if (add_level(&hierarchy, optarg) < 0) {
+                    printf("%s: Bad cache level %s\n", argv[0], optarg);
+                    print_usage(argv);
+                    exit(1);
+                }
+                break;
+            case 'm':
+                miss_curve = 1;
+                break;
+            case 'M':
+                hierarchy.mem_latency = atoi(optarg);
+                break;
+            case 'p':
+                policy_name = optarg;
+                break;
             case 's':
-                s = atoi(optarg);
+                if (parse_range(optarg, &s_range, 0) < 0) {
+                    print_usage(argv);
+                    exit(1);
+                }
+                s = s_range.lo;
+                s_set = 1;
                 break;
             case 't':
                 trace_file = optarg;
@@ -290,30 +2103,120 @@ int main(int argc, char* argv[]) {
             case 'v':
                 verbosity = 1;
                 break;
+            case 'w':
+                if (strcmp(optarg, "back") == 0) {
+                    write_through = 0;
+                } else if (strcmp(optarg, "through") == 0) {
+                    write_through = 1;
+                } else {
+                    print_usage(argv);
+                    exit(1);
+                }
+                write_policy_set = 1;
+                break;
             default:
                 print_usage(argv);
                 exit(1);
         }
     }
 
-    //Make sure that all required command line args were specified.
-    if (s == 0 || E == 0 || b == 0 || trace_file == NULL) {
+    //Make sure that all required command line args were specified, s and b may be 0.
+    if ((hierarchy.num_levels == 0 && (!s_set || E == 0 || !b_set)) || trace_file == NULL) {
         printf("%s: Missing required command line argument\n", argv[0]);
         print_usage(argv);
         exit(1);
     }
 
+    if (write_policy_set && (hierarchy.num_levels > 0 || miss_curve || format != NULL ||
+                             s_range.hi > s_range.lo || E_range.hi > E_range.lo || b_range.hi > b_range.lo)) {
+        printf("%s: -w and -a only apply to a single cache\n", argv[0]);
+        exit(1);
+    }
+    if (split_blocks && b_range.hi > b_range.lo) {
+        printf("%s: -B needs a single block size\n", argv[0]);
+        exit(1);
+    }
+
+    if (hierarchy.num_levels > 0) {
+        if (init_hierarchy(&hierarchy) < 0) {
+            printf("%s: Block sizes must not shrink from one level to the next, or change in an exclusive hierarchy\n", argv[0]);
+            exit(1);
+        }
+        replay_trace(trace_file);
+        print_hierarchy(&hierarchy);
+        free_hierarchy(&hierarchy);
+
+        //The summary is the one of L1.
+        print_summary(hit_cnt, miss_cnt, evict_cnt);
+        return 0;
+    }
+
+    replacement = NULL;
+    for (int p = 0; p < NUM_POLICIES; p++) {
+        if (strcmp(policy_name, policies[p].name) == 0)
+            replacement = &policies[p];
+    }
+    if (replacement == NULL && strcmp(policy_name, "all") != 0) {
+        printf("%s: Unknown replacement policy %s\n", argv[0], policy_name);
+        print_usage(argv);
+        exit(1);
+    }
+
+    //A range, a table format or a miss curve asks for a sweep.
+    if (miss_curve || format != NULL || s_range.hi > s_range.lo || E_range.hi > E_range.lo || b_range.hi > b_range.lo) {
+        if (format != NULL && strcmp(format, "csv") != 0 && strcmp(format, "json") != 0) {
+            printf("%s: Unknown table format %s\n", argv[0], format);
+            print_usage(argv);
+            exit(1);
+        }
+        if (s_range.hi + b_range.hi >= 64 || threads < 1) {
+            print_usage(argv);
+            exit(1);
+        }
+        if (miss_curve) {
+            if (replacement != &policies[0]) {
+                printf("%s: -m needs the lru policy\n", argv[0]);
+                exit(1);
+            }
+            run_miss_curve(trace_file, s_range, E_range, b_range, format != NULL && strcmp(format, "json") == 0);
+            return 0;
+        }
+        run_sweep(trace_file, s_range, E_range, b_range, replacement, threads,
+                  format != NULL && strcmp(format, "json") == 0);
+        return 0;
+    }
+
+    if (replacement == NULL) {
+        compare_policies(trace_file);
+        return 0;
+    }
+
     //Initialize cache.
     init_cache();
 
-    //Replay the memory access trace.
-    replay_trace(trace_file);
+    //Replay the memory access trace, opt needs to see all of it first.
+    if (replacement == &policies[POLICY_OPT]) {
+        trace_t trace;
+        long long *nextUse;
+        load_trace(trace_file, &trace);
+        nextUse = build_next_use(&trace, b);
+        cache.nextUse = nextUse;
+        replay_loaded(&trace);
+        free(nextUse);
+        free(trace.recs);
+    } else {
+        replay_trace(trace_file);
+    }
 
-    //Free memory allocated for cache.
+    //Write back what is still dirty, then free memory allocated for cache.
+    cache_flush(&cache);
     free_cache();
 
     //Print the statistics to a file.
     //DO NOT REMOVE: This function must be called for test_csim to work.
     print_summary(hit_cnt, miss_cnt, evict_cnt);
+    if (write_policy_set || verbosity) { //keep the default output to the summary line
+        print_write_summary(&cache);
+    }
     return 0;   
 } 